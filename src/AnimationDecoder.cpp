@@ -0,0 +1,342 @@
+#include <QImageReader>
+#include <QPainter>
+#include <cstring>
+#include <zlib.h>
+#include "AnimationDecoder.hpp"
+#include "Decoder.hpp"
+
+/******************* PNG chunk *******************/
+static quint32
+be32(const uchar *p)
+{
+    return (quint32(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static quint16
+be16(const uchar *p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+static void
+put_be32(QByteArray &out, quint32 v)
+{
+    out.append(char(v >> 24));
+    out.append(char(v >> 16));
+    out.append(char(v >> 8));
+    out.append(char(v));
+}
+
+static quint32
+png_crc(const QByteArray &data)
+{
+    // PNGのチャンクのCRCはzlibのcrc32と同じ
+    return crc32(crc32(0L, Z_NULL, 0),
+            reinterpret_cast<const Bytef*>(data.constData()), data.size());
+}
+
+static void
+append_chunk(QByteArray &out, const char *type, const QByteArray &body)
+{
+    const QByteArray td = QByteArray(type, 4) + body;
+    put_be32(out, body.size());
+    out += td;
+    put_be32(out, png_crc(td));
+}
+
+static const char png_signature[] = "\x89PNG\r\n\x1a\n";
+
+static bool
+apng_has_actl(const QByteArray &data)
+{
+    const uchar *p = reinterpret_cast<const uchar*>(data.constData());
+    const qint64 len = data.size();
+    if (len < 8 || memcmp(p, png_signature, 8) != 0) return false;
+
+    // acTLはIDATより前にある
+    for (qint64 pos = 8; pos + 12 <= len; )
+    {
+        const qint64 clen = be32(p+pos);
+        const uchar *type = p + pos + 4;
+        if (memcmp(type, "IDAT", 4) == 0) return false;
+        if (memcmp(type, "acTL", 4) == 0)
+        {
+            return clen >= 8 && pos + 12 + clen <= len &&
+                be32(p+pos+8) > 1;
+        }
+        pos += 12 + clen;
+    }
+    return false;
+}
+
+/******************* GIF *******************/
+static qint64
+gif_skip_sub_blocks(const uchar *p, qint64 len, qint64 pos)
+{
+    while (pos < len && p[pos] != 0) pos += p[pos] + 1;
+    return pos + 1;
+}
+
+// 画像ブロックをmax個まで数える(LZWは展開しない)
+static int
+gif_count_frames(const QByteArray &data, int max)
+{
+    const uchar *p = reinterpret_cast<const uchar*>(data.constData());
+    const qint64 len = data.size();
+    if (len < 13) return 0;
+
+    qint64 pos = 13;
+    if (p[10] & 0x80) pos += 3 * (1 << ((p[10] & 7) + 1));
+
+    int n = 0;
+    while (pos < len && n < max)
+    {
+        switch (p[pos])
+        {
+            case 0x21: // 拡張ブロック
+                pos = gif_skip_sub_blocks(p, len, pos + 2);
+                break;
+            case 0x2C: // 画像ブロック
+            {
+                if (pos + 10 > len) return n;
+                const uchar flags = p[pos+9];
+                pos += 10;
+                if (flags & 0x80) pos += 3 * (1 << ((flags & 7) + 1));
+                pos = gif_skip_sub_blocks(p, len, pos + 1);
+                n++;
+                break;
+            }
+            default:   // 0x3B(終端)か壊れたデータ
+                return n;
+        }
+    }
+    return n;
+}
+
+/******************* AnimationDecoder *******************/
+AnimationDecoder::AnimationDecoder(const QByteArray &d,
+        const QByteArray &format)
+    : data(d)
+    , fmt(format.isEmpty()
+            ? Decoder::detectFormat(d.constData(), d.size()) : format)
+    , buf()
+    , reader(nullptr)
+    , png_ihdr()
+    , png_chunks()
+    , frames()
+    , frame_no(0)
+    , canvas()
+    , saved()
+{
+    if (fmt == "png" && parseApng()) return;
+
+    buf.setData(data);
+    buf.open(QIODevice::ReadOnly);
+    reader = new QImageReader(&buf, fmt);
+}
+
+AnimationDecoder::~AnimationDecoder()
+{
+    delete reader;
+}
+
+bool
+AnimationDecoder::isAnimated(const QByteArray &data,
+        const QByteArray &format)
+{
+    const QByteArray fmt = format.isEmpty()
+        ? Decoder::detectFormat(data.constData(), data.size()) : format;
+    if (fmt == "gif") return gif_count_frames(data, 2) > 1;
+    if (fmt == "png") return apng_has_actl(data);
+    if (fmt == "webp")
+    {
+        QBuffer b;
+        b.setData(data);
+        b.open(QIODevice::ReadOnly);
+        QImageReader r(&b, fmt);
+        return r.supportsAnimation() && r.imageCount() > 1;
+    }
+    return false;
+}
+
+bool
+AnimationDecoder::readFrame(QImage &img, int &delay)
+{
+    bool ret;
+    if (reader)
+    {
+        ret = reader->canRead() && reader->read(&img);
+        delay = reader->nextImageDelay();
+    }
+    else
+    {
+        ret = readApngFrame(img, delay);
+    }
+
+    // 0や10msの指定はブラウザと同じく100msとして扱う
+    if (delay < 20) delay = 100;
+    return ret;
+}
+
+void
+AnimationDecoder::jumpToStart()
+{
+    if (reader)
+    {
+        delete reader;
+        buf.seek(0);
+        reader = new QImageReader(&buf, fmt);
+    }
+    frame_no = 0;
+    canvas = QImage();
+    saved = QImage();
+}
+
+bool
+AnimationDecoder::parseApng()
+{
+    const uchar *p = reinterpret_cast<const uchar*>(data.constData());
+    const qint64 len = data.size();
+    if (len < 8 || memcmp(p, png_signature, 8) != 0) return false;
+
+    bool actl = false;
+    bool idat = false;
+    int cur = -1;
+    for (qint64 pos = 8; pos + 12 <= len; )
+    {
+        const qint64 clen = be32(p+pos);
+        const char *type = reinterpret_cast<const char*>(p + pos + 4);
+        const uchar *body = p + pos + 8;
+        if (pos + 12 + clen > len) break;
+
+        if (memcmp(type, "IHDR", 4) == 0 && clen == 13)
+        {
+            png_ihdr = QByteArray(reinterpret_cast<const char*>(body), 13);
+        }
+        else if (memcmp(type, "acTL", 4) == 0)
+        {
+            actl = true;
+        }
+        else if (memcmp(type, "fcTL", 4) == 0 && clen >= 26)
+        {
+            ApngFrame f;
+            f.rect = QRect(be32(body+12), be32(body+16),
+                    be32(body+4), be32(body+8));
+            const int num = be16(body+20);
+            const int den = be16(body+22);
+            f.delay = num * 1000 / (den == 0 ? 100 : den);
+            f.dispose = body[24];
+            f.blend = body[25];
+            frames << f;
+            cur = frames.size() - 1;
+        }
+        else if (memcmp(type, "IDAT", 4) == 0)
+        {
+            // fcTLが先にあればデフォルト画像も最初のフレームになる
+            idat = true;
+            if (cur >= 0)
+            {
+                frames[cur].idat << QByteArray(
+                        reinterpret_cast<const char*>(body), clen);
+            }
+        }
+        else if (memcmp(type, "fdAT", 4) == 0 && clen > 4)
+        {
+            if (cur >= 0)
+            {
+                frames[cur].idat << QByteArray(
+                        reinterpret_cast<const char*>(body + 4), clen - 4);
+            }
+        }
+        else if (memcmp(type, "IEND", 4) == 0)
+        {
+            break;
+        }
+        else if (!idat)
+        {
+            png_chunks.append(reinterpret_cast<const char*>(p + pos),
+                    12 + clen);
+        }
+        pos += 12 + clen;
+    }
+
+    if (!actl || png_ihdr.isEmpty()) return false;
+    const QRect bounds(0, 0, be32((const uchar*)png_ihdr.constData()),
+            be32((const uchar*)png_ihdr.constData() + 4));
+    for (int i = 0; i < frames.size(); )
+    {
+        if (frames[i].idat.isEmpty() || frames[i].rect.isEmpty() ||
+                !bounds.contains(frames[i].rect))
+        {
+            frames.remove(i);
+        }
+        else
+        {
+            i++;
+        }
+    }
+    return frames.size() > 1;
+}
+
+bool
+AnimationDecoder::readApngFrame(QImage &img, int &delay)
+{
+    delay = 0;
+    if (frame_no >= frames.size()) return false;
+    const ApngFrame &f = frames[frame_no];
+
+    if (frame_no == 0)
+    {
+        const uchar *h = reinterpret_cast<const uchar*>(png_ihdr.constData());
+        canvas = QImage(be32(h), be32(h+4), QImage::Format_ARGB32);
+        if (canvas.isNull()) return false;
+        canvas.fill(0);
+    }
+    else
+    {
+        // 前のフレームの後始末
+        const ApngFrame &prev = frames[frame_no-1];
+        QPainter painter(&canvas);
+        painter.setCompositionMode(QPainter::CompositionMode_Source);
+        if (prev.dispose == 1)
+        {
+            painter.fillRect(prev.rect, Qt::transparent);
+        }
+        else if (prev.dispose == 2 && !saved.isNull())
+        {
+            painter.drawImage(prev.rect.topLeft(), saved);
+        }
+    }
+    saved = (f.dispose == 2) ? canvas.copy(f.rect) : QImage();
+
+    // フレームの大きさに書き換えたIHDRで単独のPNGを作る
+    QByteArray ihdr = png_ihdr;
+    QByteArray size;
+    put_be32(size, f.rect.width());
+    put_be32(size, f.rect.height());
+    ihdr.replace(0, 8, size);
+
+    QByteArray png(png_signature, 8);
+    append_chunk(png, "IHDR", ihdr);
+    png += png_chunks;
+    for (auto iter = f.idat.cbegin(); iter != f.idat.cend(); ++iter)
+    {
+        append_chunk(png, "IDAT", *iter);
+    }
+    append_chunk(png, "IEND", QByteArray());
+
+    QImage fimg;
+    if (!fimg.loadFromData(png, "png")) return false;
+
+    QPainter painter(&canvas);
+    painter.setCompositionMode(f.blend == 0
+            ? QPainter::CompositionMode_Source
+            : QPainter::CompositionMode_SourceOver);
+    painter.drawImage(f.rect.topLeft(), fimg);
+    painter.end();
+
+    img = canvas;
+    delay = f.delay;
+    frame_no++;
+    return true;
+}
@@ -0,0 +1,57 @@
+#ifndef ANIMATIONDECODER_HPP
+#define ANIMATIONDECODER_HPP
+
+#include <QByteArray>
+#include <QImage>
+#include <QBuffer>
+#include <QVector>
+#include <QRect>
+
+class QImageReader;
+
+// アニメーション画像から合成済みのフレームを順に取り出す．
+// GIFなどはQImageReaderに任せ，APNGはフレームごとのPNGを組み立てて
+// Qtでデコードしてから合成する
+class AnimationDecoder
+{
+public:
+    AnimationDecoder(const QByteArray &data, const QByteArray &format);
+    ~AnimationDecoder();
+
+    static bool isAnimated(const QByteArray &data, const QByteArray &format);
+
+    // delayはそのフレームを表示する時間(ms)．最後まで読んだらfalse
+    bool readFrame(QImage &img, int &delay);
+    void jumpToStart();
+
+private:
+    struct ApngFrame
+    {
+        QRect rect;
+        int delay;
+        uchar dispose;
+        uchar blend;
+        QVector<QByteArray> idat; // fdATはシーケンス番号を除いたもの
+    };
+
+    QByteArray data;
+    QByteArray fmt;
+    QBuffer buf;
+    QImageReader *reader;
+
+    // APNG
+    QByteArray png_ihdr;      // IHDRのデータ部分
+    QByteArray png_chunks;    // PLTEなど全フレームで共有するチャンク
+    QVector<ApngFrame> frames;
+    int frame_no;
+    QImage canvas;
+    QImage saved;             // dispose_op=PREVIOUSのための退避領域
+
+    bool parseApng();
+    bool readApngFrame(QImage &img, int &delay);
+
+    AnimationDecoder(const AnimationDecoder &) = delete;
+    AnimationDecoder &operator=(const AnimationDecoder &) = delete;
+};
+
+#endif // ANIMATIONDECODER_HPP
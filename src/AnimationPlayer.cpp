@@ -0,0 +1,138 @@
+#include <QScopedPointer>
+#include "AnimationPlayer.hpp"
+#include "AnimationDecoder.hpp"
+#include "Decoder.hpp"
+
+AnimationPlayer::AnimationPlayer(QObject *parent)
+    : QThread(parent)
+    , anim_data()
+    , anim_scale(1.0)
+    , anim_scaler(nullptr)
+    , ring()
+    , data_gen(0)
+    , scale_gen(0)
+    , playing(false)
+    , quit(false)
+{
+    start();
+}
+
+AnimationPlayer::~AnimationPlayer()
+{
+    mutex.lock();
+    quit = true;
+    cond.wakeOne();
+    mutex.unlock();
+    wait();
+}
+
+void
+AnimationPlayer::play(const QByteArray &data, double scale, Scaler scaler)
+{
+    mutex.lock();
+    anim_data = data;
+    anim_scale = scale;
+    anim_scaler = scaler;
+    ring.clear();
+    data_gen++;
+    playing = true;
+    cond.wakeOne();
+    mutex.unlock();
+}
+
+void
+AnimationPlayer::stop()
+{
+    mutex.lock();
+    anim_data.clear();
+    ring.clear();
+    data_gen++;
+    playing = false;
+    mutex.unlock();
+}
+
+bool
+AnimationPlayer::isPlaying() const
+{
+    QMutexLocker locker(&mutex);
+    return playing;
+}
+
+void
+AnimationPlayer::setScale(double scale, Scaler scaler)
+{
+    mutex.lock();
+    anim_scale = scale;
+    anim_scaler = scaler;
+    ring.clear();
+    scale_gen++;
+    cond.wakeOne();
+    mutex.unlock();
+}
+
+bool
+AnimationPlayer::takeFrame(Frame &frame)
+{
+    QMutexLocker locker(&mutex);
+    if (ring.isEmpty()) return false;
+    frame = ring.dequeue();
+    cond.wakeOne();
+    return true;
+}
+
+void
+AnimationPlayer::run()
+{
+    QScopedPointer<AnimationDecoder> dec;
+    int cur_gen = -1;
+
+    for (;;)
+    {
+        mutex.lock();
+        while (!quit && (!playing || ring.size() >= ring_size))
+        {
+            cond.wait(&mutex);
+        }
+        if (quit)
+        {
+            mutex.unlock();
+            return;
+        }
+        if (cur_gen != data_gen)
+        {
+            dec.reset(new AnimationDecoder(anim_data, QByteArray()));
+            cur_gen = data_gen;
+        }
+        const int sgen = scale_gen;
+        const double scale = anim_scale;
+        const Scaler scaler = anim_scaler;
+        mutex.unlock();
+
+        Frame frame;
+        if (!dec->readFrame(frame.img, frame.delay))
+        {
+            // 最後まで読んだら先頭に戻る
+            dec->jumpToStart();
+            if (!dec->readFrame(frame.img, frame.delay))
+            {
+                mutex.lock();
+                if (cur_gen == data_gen) playing = false;
+                mutex.unlock();
+                continue;
+            }
+        }
+
+        frame.img = Decoder::toDisplayFormat(frame.img);
+        if (scaler && !qFuzzyCompare(scale, 1.0))
+        {
+            frame.img = scaler(frame.img, scale);
+        }
+
+        mutex.lock();
+        if (cur_gen == data_gen && sgen == scale_gen)
+        {
+            ring.enqueue(frame);
+        }
+        mutex.unlock();
+    }
+}
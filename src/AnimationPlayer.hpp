@@ -0,0 +1,55 @@
+#ifndef ANIMATIONPLAYER_HPP
+#define ANIMATIONPLAYER_HPP
+
+#include <QThread>
+#include <QByteArray>
+#include <QImage>
+#include <QQueue>
+#include <QMutex>
+#include <QWaitCondition>
+
+// アニメーションのフレームを先読みしてデコード・拡大縮小しておく．
+// 先読みする枚数はring_sizeまでなので，メモリはフレーム数によらない
+class AnimationPlayer : public QThread
+{
+public:
+    typedef QImage (*Scaler)(const QImage &, const double);
+
+    struct Frame
+    {
+        QImage img;
+        int delay;  // 表示する時間(ms)
+    };
+
+    explicit AnimationPlayer(QObject *parent = 0);
+    ~AnimationPlayer();
+
+    void play(const QByteArray &data, double scale, Scaler scaler);
+    void stop();
+    bool isPlaying() const;
+
+    // 先読みしたフレームは捨てて次のフレームから倍率を変える
+    void setScale(double scale, Scaler scaler);
+
+    // 次のフレームが用意できていなければfalse
+    bool takeFrame(Frame &frame);
+
+protected:
+    void run();
+
+private:
+    QByteArray anim_data;
+    double anim_scale;
+    Scaler anim_scaler;
+    QQueue<Frame> ring;
+    int data_gen;   // play/stopごとに増やす
+    int scale_gen;  // setScaleごとに増やす
+    bool playing;
+    bool quit;
+    mutable QMutex mutex;
+    QWaitCondition cond;
+
+    static const int ring_size = 8;
+};
+
+#endif // ANIMATIONPLAYER_HPP
@@ -11,11 +11,16 @@ int    App::view_ipix;
 bool   App::view_spread;
 bool   App::view_autospread;
 bool   App::view_rbind;
+bool   App::view_splitwide;
 int    App::view_openlevel;
+int    App::view_openthreads;
+bool   App::view_watchdirs;
 int    App::view_feedpage;
+bool   App::view_fastdecode;
 
 bool   App::pl_visible;
 int    App::pl_prefetch;
+int    App::pl_packedcache;
 
 const QString App::SOFTWARE_ORG("muranoya.net");
 const QString App::SOFTWARE_NAME("SpRead");
@@ -37,13 +42,18 @@ App::SaveSettings()
     s.setValue("spread",     view_spread);
     s.setValue("autospread", view_autospread);
     s.setValue("rbind",      view_rbind);
+    s.setValue("splitwide",  view_splitwide);
     s.setValue("openlevel",  view_openlevel);
+    s.setValue("openthreads", view_openthreads);
+    s.setValue("watchdirs",  view_watchdirs);
     s.setValue("feedpage",   view_feedpage);
+    s.setValue("fastdecode", view_fastdecode);
     s.endGroup();
 
     s.beginGroup("Playlist");
     s.setValue("visible",  pl_visible);
     s.setValue("prefetch", pl_prefetch);
+    s.setValue("packedcache", pl_packedcache);
     s.endGroup();
 }
 
@@ -64,13 +74,18 @@ App::LoadSettings()
     view_spread     = s.value("spread",     false).toBool();
     view_autospread = s.value("autospread", false).toBool();
     view_rbind      = s.value("rbind",      false).toBool();
+    view_splitwide  = s.value("splitwide",  false).toBool();
     view_openlevel  = s.value("openlevel",  99).toInt();
+    view_openthreads = s.value("openthreads", 8).toInt();
+    view_watchdirs  = s.value("watchdirs",  false).toBool();
     view_feedpage   = s.value("feedpage",   Viewer::MouseButton).toInt();
+    view_fastdecode = s.value("fastdecode", false).toBool();
     s.endGroup();
 
     s.beginGroup("Playlist");
     pl_visible  = s.value("visible",  true).toBool();
     pl_prefetch = s.value("prefetch", 20).toInt();
+    pl_packedcache = s.value("packedcache", 256).toInt();
     s.endGroup();
 }
 
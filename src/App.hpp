@@ -19,12 +19,17 @@ public:
     static bool   view_spread;
     static bool   view_autospread;
     static bool   view_rbind;
+    static bool   view_splitwide;
     static int    view_openlevel;
+    static int    view_openthreads;
+    static bool   view_watchdirs;
     static int    view_feedpage;
+    static bool   view_fastdecode;
 
     // Group - Playlist
     static bool pl_visible;
     static int  pl_prefetch;
+    static int  pl_packedcache;
 
     static const QString SOFTWARE_ORG;
     static const QString SOFTWARE_NAME;
@@ -0,0 +1,870 @@
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <algorithm>
+#include <limits>
+#include <archive.h>
+#include <archive_entry.h>
+#include "ArchiveIndex.hpp"
+#include "Catalog.hpp"
+#include "Decoder.hpp"
+
+// 書庫のファイルを読むコールバック．シークのコールバックを渡さないので
+// zipも中央ディレクトリではなくローカルヘッダを順に読む形式になり，
+// ヘッダの位置をファイル上の位置として得られる．
+// gzがあればそれで展開したものを渡し，展開後の位置を得る．
+// memがあればファイルではなくそれを読む
+struct ArchiveSource
+{
+    QFile file;
+    QByteArray buf;
+    GzipIndex::Builder *gz = nullptr;
+    const QByteArray *mem = nullptr;
+    qint64 pos = 0;
+
+    ~ArchiveSource()
+    {
+        delete gz;
+    }
+};
+
+static la_ssize_t
+source_read(struct archive *a, void *data, const void **buf)
+{
+    Q_UNUSED(a);
+    ArchiveSource *src = static_cast<ArchiveSource*>(data);
+    if (src->mem)
+    {
+        // メモリ上のものはコピーせずに渡す
+        const qint64 n = std::min<qint64>(src->mem->size() - src->pos,
+                1024*1024);
+        *buf = src->mem->constData() + src->pos;
+        src->pos += n;
+        return n;
+    }
+    *buf = src->buf.constData();
+    if (src->gz) return src->gz->read(src->buf.data(), src->buf.size());
+    return src->file.read(src->buf.data(), src->buf.size());
+}
+
+static la_int64_t
+source_skip(struct archive *a, void *data, la_int64_t request)
+{
+    Q_UNUSED(a);
+    ArchiveSource *src = static_cast<ArchiveSource*>(data);
+    if (src->gz) return 0;
+    if (src->mem)
+    {
+        const qint64 to = std::min<qint64>(src->pos + request,
+                src->mem->size());
+        const qint64 n = to - src->pos;
+        src->pos = to;
+        return n;
+    }
+    const qint64 pos = src->file.pos();
+    const qint64 to = std::min(pos + request, src->file.size());
+    if (!src->file.seek(to)) return 0;
+    return to - pos;
+}
+
+static struct archive *
+open_source(ArchiveSource &src, qint64 offset)
+{
+    if (src.mem)
+    {
+        if (offset > src.mem->size()) return nullptr;
+        src.pos = offset;
+    }
+    else if (!src.file.open(QIODevice::ReadOnly) || !src.file.seek(offset))
+    {
+        return nullptr;
+    }
+    src.buf.resize(1024*128);
+
+    struct archive *a = archive_read_new();
+    archive_read_support_filter_all(a);
+    archive_read_support_format_all(a);
+    archive_read_set_callback_data(a, &src);
+    archive_read_set_read_callback(a, source_read);
+    archive_read_set_skip_callback(a, source_skip);
+    if (archive_read_open1(a) != ARCHIVE_OK)
+    {
+        archive_read_free(a);
+        return nullptr;
+    }
+    return a;
+}
+
+static struct archive *
+open_filename(const QString &path)
+{
+    struct archive *a = archive_read_new();
+    archive_read_support_filter_all(a);
+    archive_read_support_format_all(a);
+    int r = archive_read_open_filename(a,
+            path.toLocal8Bit().constData(), 1024*128);
+    if (r != ARCHIVE_OK)
+    {
+        fprintf(stderr, "%s\n", archive_error_string(a));
+        archive_read_free(a);
+        return nullptr;
+    }
+    return a;
+}
+
+static quint16
+le16(const uchar *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+// RARの主ヘッダのソリッドのフラグ．読めなければソリッドとみなす
+static bool
+rar_solid(const QByteArray &head)
+{
+    const uchar *p = (const uchar *)head.constData();
+    const int len = head.size();
+    if (head.startsWith(QByteArray("Rar!\x1a\x07\x01\x00", 8)))
+    {
+        // RAR5: CRC32のあとにヘッダの大きさ，種類，フラグ，
+        // (追加領域の大きさ)，(データ領域の大きさ)，書庫のフラグが続く
+        int pos = 12;
+        auto vint = [&](quint64 &v)
+        {
+            v = 0;
+            for (int shift = 0; pos < len && shift < 64; shift += 7)
+            {
+                v |= quint64(p[pos] & 0x7f) << shift;
+                if (!(p[pos++] & 0x80)) return true;
+            }
+            return false;
+        };
+        quint64 size, type, flags, v;
+        if (!vint(size) || !vint(type) || type != 1 || !vint(flags))
+        {
+            return true;
+        }
+        if ((flags & 0x01) && !vint(v)) return true;
+        if ((flags & 0x02) && !vint(v)) return true;
+        if (!vint(v)) return true;
+        return (v & 0x0004) != 0;
+    }
+    if (head.startsWith(QByteArray("Rar!\x1a\x07\x00", 7)))
+    {
+        // RAR4: マーカーの次の主ヘッダのフラグにMHD_SOLIDがある
+        if (len < 12 || p[9] != 0x73) return true;
+        return ((p[10] | p[11] << 8) & 0x0008) != 0;
+    }
+    return true;
+}
+
+// 暗号化されていない無圧縮のzipのエントリならデータの位置を返す
+static qint64
+zip_stored_data(const uchar *base, qint64 len, const ArchiveIndex::Entry &e)
+{
+    const qint64 off = e.offset;
+    if (off + 30 > len) return -1;
+    const uchar *p = base + off;
+    if (p[0] != 'P' || p[1] != 'K' || p[2] != 3 || p[3] != 4) return -1;
+
+    const int flags = le16(p + 6);
+    const int method = le16(p + 8);
+    const int nlen = le16(p + 26);
+    const int xlen = le16(p + 28);
+    if ((flags & 1) || method != 0) return -1;
+    if (off + 30 + nlen > len ||
+            e.name != QByteArray::fromRawData((const char *)p + 30, nlen))
+    {
+        return -1;
+    }
+    return off + 30 + nlen + xlen;
+}
+
+// 拡張ヘッダの付いていない普通のtarのエントリならデータの位置を返す
+static qint64
+tar_data(const uchar *base, qint64 len, const ArchiveIndex::Entry &e)
+{
+    const qint64 off = e.offset;
+    if (off + 512 > len) return -1;
+    const uchar *p = base + off;
+    if (p[156] != '0' && p[156] != '\0') return -1;
+
+    // 大きさは8進数の文字列
+    qint64 size = 0;
+    int i = 124;
+    while (i < 136 && p[i] == ' ') ++i;
+    for (; i < 136 && '0' <= p[i] && p[i] <= '7'; ++i)
+    {
+        size = size * 8 + (p[i] - '0');
+    }
+    if (size != e.size) return -1;
+    return off + 512;
+}
+
+ArchiveIndex::ArchiveIndex(const QString &path)
+    : archive_path(path)
+    , list()
+    , names()
+    , streaming(false)
+    , archive_fmt(0)
+    , solid(false)
+    , zip()
+    , gz()
+    , nested_data()
+    , progress()
+    , reported(0)
+    , canceled(false)
+    , map_file()
+    , map_addr(nullptr)
+    , map_size(0)
+    , map_tried(false)
+    , mutex()
+    , readers()
+    , solid_cache(solid_cache_size)
+{
+}
+
+ArchiveIndex::~ArchiveIndex()
+{
+    for (auto iter = readers.cbegin(); iter != readers.cend(); ++iter)
+    {
+        closeReader(*iter);
+    }
+    readers.clear();
+}
+
+QSharedPointer<ArchiveIndex>
+ArchiveIndex::build(const QString &path, const EntryCallback &callback)
+{
+    QSharedPointer<ArchiveIndex> index(new ArchiveIndex(path));
+    index->progress = callback;
+    const QFileInfo info(path);
+    bool ok = index->restore(info);
+    if (!ok && !index->canceled)
+    {
+        // 7zなど先頭から順に読めない形式はこれまで通りに開く
+        ok = index->scanZip();
+        if (!ok && !index->canceled) ok = index->scan(true);
+        if (!ok && !index->canceled) ok = index->scan(false);
+        if (ok) index->save(info);
+    }
+    index->progress = EntryCallback();
+    if (!ok) return QSharedPointer<ArchiveIndex>();
+    return index;
+}
+
+QSharedPointer<ArchiveIndex>
+ArchiveIndex::build(const QSharedPointer<const ArchiveIndex> &parent,
+        const QByteArray &name)
+{
+    const Entry *e = parent->find(name);
+    if (!e || !e->nested || e->size > std::numeric_limits<int>::max())
+    {
+        return QSharedPointer<ArchiveIndex>();
+    }
+
+    QSharedPointer<ArchiveIndex> index(
+            new ArchiveIndex(parent->path() + "/" + QString(name)));
+
+    // 無圧縮で格納されていれば親の書庫をマップした領域をそのまま使う
+    ImageFile::Data &data = index->nested_data;
+    if (!parent->mapEntry(name, data))
+    {
+        bool found;
+        QByteArray &bytes = data.bytes;
+        if (e->size > 0) bytes.reserve(e->size);
+        const bool ok = parent->readEntry(name,
+                [&bytes](const char *buf, qint64 len)
+                {
+                    bytes.append(buf, len);
+                    return true;
+                }, found);
+        if (!ok) return QSharedPointer<ArchiveIndex>();
+    }
+    if (data.bytes.isEmpty() ||
+            (!index->scan(true) && !index->scan(false)))
+    {
+        return QSharedPointer<ArchiveIndex>();
+    }
+    return index;
+}
+
+const QString &
+ArchiveIndex::path() const
+{
+    return archive_path;
+}
+
+const QVector<ArchiveIndex::Entry> &
+ArchiveIndex::entries() const
+{
+    return list;
+}
+
+const ArchiveIndex::Entry *
+ArchiveIndex::find(const QByteArray &name) const
+{
+    auto iter = names.constFind(name);
+    if (iter == names.constEnd()) return nullptr;
+    return &list[iter.value()];
+}
+
+bool
+ArchiveIndex::isRandomAccess() const
+{
+    return !zip.isNull() || !gz.isNull();
+}
+
+bool
+ArchiveIndex::isNested() const
+{
+    return !nested_data.bytes.isEmpty();
+}
+
+bool
+ArchiveIndex::readEntry(const QByteArray &name,
+        const ImageFile::BlockReader &reader, bool &found) const
+{
+    found = false;
+    const Entry *e = find(name);
+    if (!e) return false;
+
+    // 暗号化などで扱えないエントリはlibarchiveで先頭から読ませる
+    if (zip)
+    {
+        const ZipReader::Entry &z = zip->entries()[e->ordinal];
+        found = ZipReader::isSupported(z);
+        return found && zip->read(z, reader);
+    }
+
+    if (gz) return readGzip(*e, e->size, reader, found);
+    if (solid && readCached(name, reader, found)) return true;
+
+    Reader *r = takeReader(*e);
+    if (!r) return false;
+
+    // 目的のエントリまで読み飛ばす．データは次のヘッダを読むときに飛ばされる
+    struct archive_entry *ae = nullptr;
+    while (r->next <= e->ordinal)
+    {
+        if (archive_read_next_header(r->a, &ae) != ARCHIVE_OK)
+        {
+            closeReader(r);
+            return false;
+        }
+        r->next++;
+        // ソリッド書庫では飛ばしても展開されるので，近いものは取っておく
+        if (solid && r->next <= e->ordinal &&
+                e->ordinal - r->next < max_solid_entries)
+        {
+            cacheEntry(r->a, QByteArray(archive_entry_pathname(ae)));
+        }
+    }
+    if (name != archive_entry_pathname(ae))
+    {
+        closeReader(r);
+        return false;
+    }
+    found = true;
+
+    const void *buf;
+    size_t len;
+    la_int64_t offset;
+    int ret;
+    while ((ret = archive_read_data_block(r->a, &buf, &len, &offset))
+            == ARCHIVE_OK)
+    {
+        if (!reader((const char *)buf, len))
+        {
+            break;
+        }
+    }
+    if (ret == ARCHIVE_OK || ret == ARCHIVE_EOF)
+    {
+        putReader(r);
+    }
+    else
+    {
+        closeReader(r);
+    }
+    return ret == ARCHIVE_EOF;
+}
+
+bool
+ArchiveIndex::mapEntry(const QByteArray &name, ImageFile::Data &data) const
+{
+    const Entry *e = find(name);
+    if (!e || gz || isNested() || e->offset < 0 || e->size <= 0 ||
+            e->size > std::numeric_limits<int>::max())
+    {
+        return false;
+    }
+
+    QSharedPointer<QFile> file;
+    const uchar *base;
+    qint64 len;
+    {
+        QMutexLocker locker(&mutex);
+        if (!map_tried)
+        {
+            map_tried = true;
+            QSharedPointer<QFile> f(new QFile(archive_path));
+            if (f->open(QIODevice::ReadOnly))
+            {
+                map_size = f->size();
+                map_addr = f->map(0, map_size);
+                if (map_addr) map_file = f;
+            }
+        }
+        file = map_file;
+        base = map_addr;
+        len = map_size;
+    }
+    if (!file) return false;
+    // マップした後で書き換えられて大きさが変わっていればマップは使わない
+    if (QFileInfo(archive_path).size() != len) return false;
+
+    qint64 pos = -1;
+    switch (archive_fmt)
+    {
+        case ARCHIVE_FORMAT_ZIP: pos = zip_stored_data(base, len, *e); break;
+        case ARCHIVE_FORMAT_TAR: pos = tar_data(base, len, *e);        break;
+    }
+    if (pos < 0 || pos + e->size > len) return false;
+
+    data.bytes = QByteArray::fromRawData((const char *)base + pos, e->size);
+    data.map = file;
+    return true;
+}
+
+bool
+ArchiveIndex::readHead(const QByteArray &name, qint64 len,
+        QByteArray &head) const
+{
+    const Entry *e = find(name);
+    if (!e) return false;
+    if (gz)
+    {
+        head.clear();
+        bool found;
+        readGzip(*e, std::min(len, e->size),
+                [&head](const char *buf, qint64 n)
+                {
+                    head.append(buf, n);
+                    return true;
+                }, found);
+        return found;
+    }
+    if (isNested())
+    {
+        // 親の書庫を走査しても見つからないので，ここで読む
+        head.clear();
+        bool found;
+        readEntry(name, [&head, len](const char *buf, qint64 n)
+                {
+                    head.append(buf, std::min(n, len - head.size()));
+                    return head.size() < len;
+                }, found);
+        return true;
+    }
+    if (!zip) return false;
+    const ZipReader::Entry &z = zip->entries()[e->ordinal];
+    if (!ZipReader::isSupported(z)) return false;
+    head = zip->readHead(z, len);
+    return true;
+}
+
+ArchiveIndex::Reader *
+ArchiveIndex::openReader(qint64 offset, int ordinal) const
+{
+    Reader *r = new Reader;
+    r->next = ordinal;
+    if (streaming)
+    {
+        r->src = new ArchiveSource;
+        r->src->file.setFileName(archive_path);
+        if (isNested()) r->src->mem = &nested_data.bytes;
+        r->a = open_source(*r->src, offset);
+    }
+    else
+    {
+        r->src = nullptr;
+        r->a = openWhole();
+    }
+    if (!r->a)
+    {
+        closeReader(r);
+        return nullptr;
+    }
+    return r;
+}
+
+ArchiveIndex::Reader *
+ArchiveIndex::takeReader(const Entry &e) const
+{
+    Reader *r = nullptr;
+    {
+        // eより前で止まっているハンドルのうち一番近いものを使う
+        QMutexLocker locker(&mutex);
+        int best = -1;
+        for (int i = 0; i < readers.count(); ++i)
+        {
+            const int next = readers[i]->next;
+            if (next <= e.ordinal &&
+                    (best < 0 || readers[best]->next < next))
+            {
+                best = i;
+            }
+        }
+        if (best >= 0 && (e.offset < 0 ||
+                    e.ordinal - readers[best]->next <= max_skip_entries))
+        {
+            r = readers.takeAt(best);
+        }
+    }
+    if (r) return r;
+
+    if (e.offset >= 0) return openReader(e.offset, e.ordinal);
+    return openReader(0, 0);
+}
+
+void
+ArchiveIndex::putReader(Reader *r) const
+{
+    Reader *old = nullptr;
+    {
+        QMutexLocker locker(&mutex);
+        readers << r;
+        if (readers.count() > max_readers) old = readers.takeFirst();
+    }
+    if (old) closeReader(old);
+}
+
+bool
+ArchiveIndex::readGzip(const Entry &e, qint64 len,
+        const ImageFile::BlockReader &reader, bool &found) const
+{
+    // ヘッダも続けて展開し，普通のファイルのエントリか確かめる
+    found = false;
+    if (e.offset < 0 || e.size < 0) return false;
+    QByteArray header;
+    const bool ret = gz->read(e.offset, 512 + len,
+            [&](const char *buf, qint64 n)
+            {
+                if (header.size() < 512)
+                {
+                    const qint64 c = std::min<qint64>(n, 512 - header.size());
+                    header.append(buf, c);
+                    buf += c;
+                    n -= c;
+                    if (header.size() < 512) return true;
+
+                    Entry t = e;
+                    t.offset = 0;
+                    if (tar_data((const uchar *)header.constData(),
+                                header.size(), t) < 0)
+                    {
+                        return false;
+                    }
+                    found = true;
+                }
+                return n <= 0 || reader(buf, n);
+            });
+    return found && ret;
+}
+
+bool
+ArchiveIndex::readCached(const QByteArray &name,
+        const ImageFile::BlockReader &reader, bool &found) const
+{
+    QByteArray bytes;
+    {
+        QMutexLocker locker(&mutex);
+        const QByteArray *c = solid_cache.object(name);
+        if (!c) return false;
+        bytes = *c;
+    }
+    found = true;
+    reader(bytes.constData(), bytes.size());
+    return true;
+}
+
+void
+ArchiveIndex::cacheEntry(struct archive *a, const QByteArray &name) const
+{
+    if (!find(name)) return;
+    {
+        QMutexLocker locker(&mutex);
+        if (solid_cache.contains(name)) return;
+    }
+
+    QByteArray bytes;
+    const void *buf;
+    size_t len;
+    la_int64_t offset;
+    int ret;
+    while ((ret = archive_read_data_block(a, &buf, &len, &offset))
+            == ARCHIVE_OK)
+    {
+        bytes.append((const char *)buf, len);
+    }
+    if (ret != ARCHIVE_EOF) return;
+
+    const int cost = std::max(1, bytes.size() / 1024);
+    QMutexLocker locker(&mutex);
+    solid_cache.insert(name, new QByteArray(bytes), cost);
+}
+
+void
+ArchiveIndex::closeReader(Reader *r)
+{
+    if (r->a) archive_read_free(r->a);
+    delete r->src;
+    delete r;
+}
+
+struct archive *
+ArchiveIndex::openWhole() const
+{
+    if (!isNested()) return open_filename(archive_path);
+
+    struct archive *a = archive_read_new();
+    archive_read_support_filter_all(a);
+    archive_read_support_format_all(a);
+    const QByteArray &bytes = nested_data.bytes;
+    if (archive_read_open_memory(a, bytes.constData(), bytes.size())
+            != ARCHIVE_OK)
+    {
+        fprintf(stderr, "%s\n", archive_error_string(a));
+        archive_read_free(a);
+        return nullptr;
+    }
+    return a;
+}
+
+bool
+ArchiveIndex::addEntry(Entry &e)
+{
+    const QString name(e.name);
+    e.nested = e.format.isEmpty() &&
+        !ImageFile::isReadableImageFile(name) &&
+        ImageFile::isReadableArchiveFile(name);
+    if (e.format.isEmpty() && !e.nested &&
+            !ImageFile::isReadableImageFile(name))
+    {
+        return true;
+    }
+    names.insert(e.name, list.count());
+    list << e;
+
+    // 読み直したときは知らせたエントリを飛ばす
+    if (list.count() <= reported) return true;
+    reported++;
+    if (progress && !e.nested && !progress(e))
+    {
+        canceled = true;
+        return false;
+    }
+    return true;
+}
+
+// 前に走査したときから変わっていなければ，保存しておいた一覧から作る
+bool
+ArchiveIndex::restore(const QFileInfo &info)
+{
+    Catalog::Archive a;
+    if (!Catalog::findArchive(info, a)) return false;
+
+    // zipは中央ディレクトリだけを読み直して，エントリを直接読めるようにする
+    if (a.zip)
+    {
+        zip = ZipReader::open(archive_path);
+        if (!zip) return false;
+        for (auto e = a.entries.cbegin(); e != a.entries.cend(); ++e)
+        {
+            if (e->ordinal < 0 || e->ordinal >= zip->entries().count())
+            {
+                zip.clear();
+                return false;
+            }
+        }
+    }
+    archive_fmt = a.format;
+    streaming = a.streaming;
+    solid = a.solid;
+
+    for (auto iter = a.entries.begin(); iter != a.entries.end(); ++iter)
+    {
+        if (!addEntry(*iter)) return false;
+    }
+    return true;
+}
+
+void
+ArchiveIndex::save(const QFileInfo &info) const
+{
+    // gzipのチェックポイントは保存しないので，次も走査して作り直す
+    if (gz) return;
+
+    Catalog::Archive a;
+    a.zip = !zip.isNull();
+    a.format = archive_fmt;
+    a.streaming = streaming;
+    a.solid = solid;
+    a.entries = list;
+    Catalog::storeArchive(info, a);
+}
+
+// 7zはほとんどがソリッドで，そうでないかを知るには圧縮された
+// ヘッダを展開する必要があるので，形式だけで決める．
+// RARは主ヘッダのフラグを見て，ソリッドでなければ読み飛ばしは安い
+bool
+ArchiveIndex::isSolid(int fmt) const
+{
+    if (fmt == ARCHIVE_FORMAT_7ZIP) return true;
+    bool rar = fmt == ARCHIVE_FORMAT_RAR;
+#ifdef ARCHIVE_FORMAT_RAR_V5
+    rar = rar || fmt == ARCHIVE_FORMAT_RAR_V5;
+#endif
+    if (!rar) return false;
+
+    QByteArray head;
+    if (isNested())
+    {
+        head = nested_data.bytes.left(64);
+    }
+    else
+    {
+        QFile file(archive_path);
+        if (!file.open(QIODevice::ReadOnly)) return true;
+        head = file.read(64);
+    }
+    return rar_solid(head);
+}
+
+bool
+ArchiveIndex::scanZip()
+{
+    if (isNested()) return false;
+    zip = ZipReader::open(archive_path);
+    if (!zip) return false;
+
+    const QVector<ZipReader::Entry> &zl = zip->entries();
+    for (int i = 0; i < zl.count(); ++i)
+    {
+        const ZipReader::Entry &z = zl[i];
+        Entry e;
+        e.name = z.name;
+        e.offset = z.offset;
+        e.size = z.usize;
+        e.ordinal = i;
+
+        const QByteArray head = zip->readHead(z, 16);
+        e.format = Decoder::detectFormat(head.constData(), head.size());
+        if (!addEntry(e)) return false;
+    }
+    archive_fmt = ARCHIVE_FORMAT_ZIP;
+    return true;
+}
+
+bool
+ArchiveIndex::scan(bool stream)
+{
+    list.clear();
+    names.clear();
+    streaming = stream;
+    solid = false;
+
+    gz.clear();
+
+    ArchiveSource src;
+    struct archive *a;
+    if (stream)
+    {
+        src.file.setFileName(archive_path);
+        if (isNested())
+        {
+            src.mem = &nested_data.bytes;
+        }
+        else if (GzipIndex::isGzip(archive_path))
+        {
+            src.gz = new GzipIndex::Builder(archive_path);
+        }
+        a = open_source(src, 0);
+    }
+    else
+    {
+        a = openWhole();
+    }
+    if (!a) return false;
+
+    struct archive_entry *ae;
+    int r;
+    for (int ordinal = 0;
+            (r = archive_read_next_header(a, &ae)) == ARCHIVE_OK;
+            ++ordinal)
+    {
+        // 形式は最初のヘッダを読むと分かる
+        if (ordinal == 0)
+        {
+            solid = isSolid(archive_format(a) & ARCHIVE_FORMAT_BASE_MASK);
+        }
+        if (archive_entry_filetype(ae) != AE_IFREG) continue;
+
+        Entry e;
+        e.name = QByteArray(archive_entry_pathname(ae));
+        e.offset = stream ? archive_read_header_position(a) : -1;
+        e.size = archive_entry_size_is_set(ae) ? archive_entry_size(ae) : -1;
+        e.ordinal = ordinal;
+
+        // 拡張子ではなく先頭のバイト列で判定する．ソリッド書庫や
+        // 先頭から順に読めない形式ではブロックの展開になるので，
+        // ヘッダだけを読む
+        if (stream && !solid)
+        {
+            char head[16];
+            la_ssize_t len = archive_read_data(a, head, sizeof(head));
+            e.format = Decoder::detectFormat(head, len);
+        }
+        if (!addEntry(e))
+        {
+            archive_read_free(a);
+            return false;
+        }
+    }
+
+    // ヘッダの位置がファイル上の位置になるのは圧縮していないtarとzipだけ
+    const int fmt = archive_format(a) & ARCHIVE_FORMAT_BASE_MASK;
+    bool seekable = stream &&
+        archive_filter_count(a) == 1 &&
+        (fmt == ARCHIVE_FORMAT_TAR || fmt == ARCHIVE_FORMAT_ZIP);
+
+    if (r != ARCHIVE_EOF)
+    {
+        // 先頭から順に読めなかったときはやり直させる
+        if (stream)
+        {
+            archive_read_free(a);
+            return false;
+        }
+        fprintf(stderr, "%s\n", archive_error_string(a));
+    }
+    archive_read_free(a);
+
+    // gzipではヘッダの位置は展開後の位置なので，チェックポイントから読む
+    if (seekable && src.gz)
+    {
+        if (fmt == ARCHIVE_FORMAT_TAR) gz = src.gz->finish();
+        seekable = !gz.isNull();
+    }
+
+    archive_fmt = seekable ? fmt : 0;
+    if (!seekable)
+    {
+        for (auto iter = list.begin(); iter != list.end(); ++iter)
+        {
+            iter->offset = -1;
+        }
+    }
+    return true;
+}
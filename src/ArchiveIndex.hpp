@@ -0,0 +1,138 @@
+#ifndef ARCHIVEINDEX_HPP
+#define ARCHIVEINDEX_HPP
+
+#include <QString>
+#include <QByteArray>
+#include <QVector>
+#include <QList>
+#include <QHash>
+#include <QCache>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QFile>
+#include <QFileInfo>
+#include "ImageFile.hpp"
+#include "ZipReader.hpp"
+#include "GzipIndex.hpp"
+
+struct ArchiveSource;
+
+// 書庫の中の画像エントリの一覧．同じ書庫のImageFileで共有し，
+// ヘッダの位置が分かっていればそこから直接エントリを読む．
+// 読み終えた書庫のハンドルは次のエントリの前で待たせておき，
+// 後ろのエントリを読むときに先頭から開き直さずに使う．
+// zipは中央ディレクトリから作り，どのエントリも直接読む．
+// 7zなどのソリッド書庫では読み飛ばすために展開したエントリを
+// 捨てずに取っておき，隣のページで同じブロックを展開し直さない．
+// gzipで圧縮したtarは最初の走査でチェックポイントを作り，そこから読む．
+// 書庫の中の書庫は一度だけメモリに読み，その中のエントリで共有する．
+// 走査した結果はCatalogに保存し，変わっていない書庫は走査しない
+class ArchiveIndex
+{
+public:
+    struct Entry
+    {
+        QByteArray name;
+        QByteArray format;  // 先頭バイトから判定したフォーマット
+        qint64 offset;      // ヘッダの位置．分からなければ-1
+        qint64 size;        // 展開後の大きさ．分からなければ-1
+        int ordinal;        // 書庫の先頭から何番目のヘッダか
+                            // zipでは中央ディレクトリの何番目か
+        bool nested;        // 画像ではなく書庫のエントリ
+    };
+
+    ~ArchiveIndex();
+    ArchiveIndex(const ArchiveIndex &) = delete;
+    ArchiveIndex &operator=(const ArchiveIndex &) = delete;
+
+    // 見つけた画像のエントリを順に渡す．falseを返すと走査を止める
+    typedef std::function<bool(const Entry &e)> EntryCallback;
+
+    // 書庫を一度だけ走査して作る．開けないか止めたときはnull
+    static QSharedPointer<ArchiveIndex> build(const QString &path,
+            const EntryCallback &callback = EntryCallback());
+    // parentの中の書庫nameを読んで作る．pathは parent/name になる
+    static QSharedPointer<ArchiveIndex> build(
+            const QSharedPointer<const ArchiveIndex> &parent,
+            const QByteArray &name);
+
+    const QString &path() const;
+    const QVector<Entry> &entries() const;
+    const Entry *find(const QByteArray &name) const;
+    // 順番に関係なくどのエントリも同時に読めるか
+    bool isRandomAccess() const;
+    // 書庫の中の書庫か
+    bool isNested() const;
+
+    // エントリを読む．書庫の中に見つからなければfoundをfalseにして返す
+    bool readEntry(const QByteArray &name,
+            const ImageFile::BlockReader &reader, bool &found) const;
+    // 無圧縮で格納されたエントリなら，書庫をマップした領域を
+    // コピーせずに指すデータを返す
+    bool mapEntry(const QByteArray &name, ImageFile::Data &data) const;
+    // 展開したデータの先頭を読む．直接読めないエントリならfalse
+    bool readHead(const QByteArray &name, qint64 len,
+            QByteArray &head) const;
+
+private:
+    // 開いたままの書庫．nextは次に読むヘッダの番号
+    struct Reader
+    {
+        struct archive *a;
+        ArchiveSource *src;
+        int next;
+    };
+
+    explicit ArchiveIndex(const QString &path);
+
+    QString archive_path;
+    QVector<Entry> list;
+    QHash<QByteArray, int> names;
+    bool streaming;             // 先頭から順に読む形式で開けたか
+    int archive_fmt;            // ヘッダの位置が分かる形式(tar/zip)か0
+    bool solid;                 // 読み飛ばすにも展開が要る形式か
+    QSharedPointer<ZipReader> zip;
+    QSharedPointer<GzipIndex> gz;   // tar.gzのチェックポイント
+    ImageFile::Data nested_data;    // 書庫の中の書庫の内容
+    EntryCallback progress;         // 作っている間だけ使う
+    int reported;                   // progressに渡したエントリの数
+    bool canceled;
+
+    mutable QSharedPointer<QFile> map_file; // 書庫全体をマップしたもの
+    mutable const uchar *map_addr;
+    mutable qint64 map_size;
+    mutable bool map_tried;
+
+    mutable QMutex mutex;
+    mutable QList<Reader*> readers; // 使っていないハンドル(古い順)
+    // ソリッド書庫で読み飛ばしたエントリ．コストはKiB
+    mutable QCache<QByteArray, QByteArray> solid_cache;
+
+    // 書庫ごとに待たせておくハンドルの数
+    static const int max_readers = 4;
+    // ヘッダの位置へ直接移る方が速くなる，読み飛ばすエントリの数
+    static const int max_skip_entries = 8;
+    // 目的のエントリの手前で展開して取っておくエントリの数
+    static const int max_solid_entries = 8;
+    // 取っておくエントリの合計(KiB)
+    static const int solid_cache_size = 64*1024;
+
+    struct archive *openWhole() const;
+    bool restore(const QFileInfo &info);
+    void save(const QFileInfo &info) const;
+    bool addEntry(Entry &e);
+    bool scanZip();
+    bool scan(bool streaming);
+    bool isSolid(int fmt) const;
+    Reader *openReader(qint64 offset, int ordinal) const;
+    Reader *takeReader(const Entry &e) const;
+    void putReader(Reader *r) const;
+    bool readGzip(const Entry &e, qint64 len,
+            const ImageFile::BlockReader &reader, bool &found) const;
+    bool readCached(const QByteArray &name,
+            const ImageFile::BlockReader &reader, bool &found) const;
+    void cacheEntry(struct archive *a, const QByteArray &name) const;
+    static void closeReader(Reader *r);
+};
+
+#endif // ARCHIVEINDEX_HPP
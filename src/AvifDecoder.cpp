@@ -0,0 +1,100 @@
+#include <QThread>
+#include "AvifDecoder.hpp"
+
+#ifdef USE_LIBAVIF
+#include <avif/avif.h>
+
+static avifDecoder *
+avif_create(const QByteArray &data)
+{
+    avifDecoder *decoder = avifDecoderCreate();
+    if (!decoder) return nullptr;
+
+    if (avifCodecName(AVIF_CODEC_CHOICE_DAV1D, AVIF_CODEC_FLAG_CAN_DECODE))
+    {
+        decoder->codecChoice = AVIF_CODEC_CHOICE_DAV1D;
+    }
+    decoder->maxThreads = QThread::idealThreadCount();
+
+    if (avifDecoderSetIOMemory(decoder,
+                reinterpret_cast<const uint8_t*>(data.constData()),
+                data.size()) != AVIF_RESULT_OK ||
+            avifDecoderParse(decoder) != AVIF_RESULT_OK)
+    {
+        avifDecoderDestroy(decoder);
+        return nullptr;
+    }
+    return decoder;
+}
+#endif
+
+bool
+AvifDecoder::isAvailable()
+{
+#ifdef USE_LIBAVIF
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool
+AvifDecoder::readHeader(const QByteArray &data, QSize &size)
+{
+#ifdef USE_LIBAVIF
+    // Parseまでならピクセルはデコードされない
+    avifDecoder *decoder = avif_create(data);
+    if (!decoder) return false;
+    size = QSize(decoder->image->width, decoder->image->height);
+    avifDecoderDestroy(decoder);
+    return true;
+#else
+    Q_UNUSED(data);
+    Q_UNUSED(size);
+    return false;
+#endif
+}
+
+bool
+AvifDecoder::decode(const QByteArray &data, QImage &img)
+{
+#ifdef USE_LIBAVIF
+    avifDecoder *decoder = avif_create(data);
+    if (!decoder) return false;
+    if (avifDecoderNextImage(decoder) != AVIF_RESULT_OK)
+    {
+        avifDecoderDestroy(decoder);
+        return false;
+    }
+
+    const avifImage *image = decoder->image;
+    QImage out(image->width, image->height,
+            decoder->alphaPresent ? QImage::Format_ARGB32
+                                  : QImage::Format_RGB32);
+    if (out.isNull())
+    {
+        avifDecoderDestroy(decoder);
+        return false;
+    }
+
+    avifRGBImage rgb;
+    avifRGBImageSetDefaults(&rgb, image);
+    rgb.depth = 8;
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+    rgb.format = AVIF_RGB_FORMAT_BGRA;
+#else
+    rgb.format = AVIF_RGB_FORMAT_ARGB;
+#endif
+    rgb.pixels = out.bits();
+    rgb.rowBytes = out.bytesPerLine();
+
+    bool ret = (avifImageYUVToRGB(image, &rgb) == AVIF_RESULT_OK);
+    avifDecoderDestroy(decoder);
+    if (ret) img = out;
+    return ret;
+#else
+    Q_UNUSED(data);
+    Q_UNUSED(img);
+    return false;
+#endif
+}
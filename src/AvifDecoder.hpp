@@ -0,0 +1,21 @@
+#ifndef AVIFDECODER_HPP
+#define AVIFDECODER_HPP
+
+#include <QByteArray>
+#include <QImage>
+#include <QSize>
+
+// libavifでデコードする．AV1のデコーダはdav1dがあればそれを使う
+class AvifDecoder
+{
+public:
+    static bool isAvailable();
+
+    static bool readHeader(const QByteArray &data, QSize &size);
+    static bool decode(const QByteArray &data, QImage &img);
+
+private:
+    AvifDecoder() = delete;
+};
+
+#endif // AVIFDECODER_HPP
@@ -0,0 +1,289 @@
+#include <QThreadStorage>
+#include <QAtomicInt>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QVariant>
+#include <QDataStream>
+#include <QDateTime>
+#include <QStandardPaths>
+#include <QDir>
+#include "Catalog.hpp"
+
+static QThreadStorage<Catalog*> catalogs;
+static QAtomicInt conn_no;
+
+static QString
+abs_path(const QString &path)
+{
+    return QDir(path).absolutePath();
+}
+
+// 書庫のエントリの一覧は行に分けずにまとめて1つの値にする
+static QByteArray
+pack_entries(const QVector<ArchiveIndex::Entry> &entries)
+{
+    QByteArray bytes;
+    QDataStream out(&bytes, QIODevice::WriteOnly);
+    out << qint32(entries.count());
+    for (auto e = entries.cbegin(); e != entries.cend(); ++e)
+    {
+        out << e->name << e->format << e->offset << e->size
+            << qint32(e->ordinal) << e->nested;
+    }
+    return bytes;
+}
+
+static bool
+unpack_entries(const QByteArray &bytes, QVector<ArchiveIndex::Entry> &entries)
+{
+    QDataStream in(bytes);
+    qint32 n;
+    in >> n;
+    if (in.status() != QDataStream::Ok || n < 0) return false;
+    entries.clear();
+    entries.reserve(n);
+    for (qint32 i = 0; i < n; ++i)
+    {
+        ArchiveIndex::Entry e;
+        qint32 ordinal;
+        in >> e.name >> e.format >> e.offset >> e.size >> ordinal >> e.nested;
+        e.ordinal = ordinal;
+        entries << e;
+    }
+    return in.status() == QDataStream::Ok;
+}
+
+Catalog::Catalog()
+    : conn(QString("catalog%1").arg(conn_no.fetchAndAddOrdered(1)))
+    , ok(false)
+{
+    const QString dir =
+        QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+    if (dir.isEmpty() || !QDir().mkpath(dir) ||
+            !QSqlDatabase::isDriverAvailable("QSQLITE"))
+    {
+        return;
+    }
+
+    QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", conn);
+    db.setDatabaseName(dir + "/catalog.sqlite");
+    // 他のスレッドが書き込んでいる間は待つ
+    db.setConnectOptions("QSQLITE_BUSY_TIMEOUT=5000");
+    if (!db.open())
+    {
+        fprintf(stderr, "cannot open the catalog\n");
+        return;
+    }
+
+    QSqlQuery q(db);
+    q.exec("PRAGMA journal_mode=WAL");
+    q.exec("PRAGMA synchronous=NORMAL");
+    if (q.exec("PRAGMA user_version") && q.next() &&
+            q.value(0).toInt() != version)
+    {
+        // 古い形式のものは捨てて作り直す
+        q.exec("DROP TABLE IF EXISTS archives");
+        q.exec("DROP TABLE IF EXISTS files");
+        q.exec("DROP TABLE IF EXISTS pages");
+        q.exec(QString("PRAGMA user_version=%1").arg(version));
+    }
+    ok = q.exec("CREATE TABLE IF NOT EXISTS archives ("
+                "path TEXT PRIMARY KEY, size INTEGER, mtime INTEGER, "
+                "zip INTEGER, format INTEGER, streaming INTEGER, "
+                "solid INTEGER, entries BLOB)") &&
+         q.exec("CREATE TABLE IF NOT EXISTS files ("
+                "dir TEXT, name TEXT, size INTEGER, mtime INTEGER, "
+                "format BLOB, PRIMARY KEY (dir, name))") &&
+         q.exec("CREATE TABLE IF NOT EXISTS pages ("
+                "path TEXT, key TEXT, size INTEGER, mtime INTEGER, "
+                "width INTEGER, height INTEGER, format BLOB, "
+                "bytes INTEGER, PRIMARY KEY (path, key))");
+}
+
+Catalog::~Catalog()
+{
+    if (!QSqlDatabase::contains(conn)) return;
+    {
+        // 接続を指しているものを先に破棄してから取り除く
+        QSqlDatabase db = QSqlDatabase::database(conn, false);
+        db.close();
+    }
+    QSqlDatabase::removeDatabase(conn);
+}
+
+bool
+Catalog::findArchive(const QFileInfo &info, Archive &archive)
+{
+    Catalog *c = local();
+    if (!c) return false;
+
+    QSqlQuery q(QSqlDatabase::database(c->conn, false));
+    q.prepare("SELECT zip, format, streaming, solid, entries FROM archives "
+              "WHERE path = ? AND size = ? AND mtime = ?");
+    q.addBindValue(info.absoluteFilePath());
+    q.addBindValue(info.size());
+    q.addBindValue(modifiedTime(info));
+    if (!q.exec() || !q.next()) return false;
+
+    archive.zip = q.value(0).toBool();
+    archive.format = q.value(1).toInt();
+    archive.streaming = q.value(2).toBool();
+    archive.solid = q.value(3).toBool();
+    return unpack_entries(q.value(4).toByteArray(), archive.entries);
+}
+
+void
+Catalog::storeArchive(const QFileInfo &info, const Archive &archive)
+{
+    Catalog *c = local();
+    if (!c) return;
+
+    QSqlQuery q(QSqlDatabase::database(c->conn, false));
+    q.prepare("INSERT OR REPLACE INTO archives "
+              "(path, size, mtime, zip, format, streaming, solid, entries) "
+              "VALUES (?, ?, ?, ?, ?, ?, ?, ?)");
+    q.addBindValue(info.absoluteFilePath());
+    q.addBindValue(info.size());
+    q.addBindValue(modifiedTime(info));
+    q.addBindValue(archive.zip);
+    q.addBindValue(archive.format);
+    q.addBindValue(archive.streaming);
+    q.addBindValue(archive.solid);
+    q.addBindValue(pack_entries(archive.entries));
+    q.exec();
+}
+
+QHash<QString, Catalog::FileFormat>
+Catalog::findFormats(const QString &dir)
+{
+    QHash<QString, FileFormat> formats;
+    Catalog *c = local();
+    if (!c) return formats;
+
+    QSqlQuery q(QSqlDatabase::database(c->conn, false));
+    q.setForwardOnly(true);
+    q.prepare("SELECT name, size, mtime, format FROM files WHERE dir = ?");
+    q.addBindValue(abs_path(dir));
+    if (!q.exec()) return formats;
+    while (q.next())
+    {
+        FileFormat f;
+        f.size = q.value(1).toLongLong();
+        f.mtime = q.value(2).toLongLong();
+        f.format = q.value(3).toByteArray();
+        formats.insert(q.value(0).toString(), f);
+    }
+    return formats;
+}
+
+void
+Catalog::storeFormats(const QString &dir,
+        const QHash<QString, FileFormat> &formats)
+{
+    Catalog *c = local();
+    if (!c) return;
+
+    // 消えたファイルが残らないようにディレクトリごと入れ替える
+    QSqlDatabase db = QSqlDatabase::database(c->conn, false);
+    const QString path = abs_path(dir);
+    db.transaction();
+    QSqlQuery q(db);
+    q.prepare("DELETE FROM files WHERE dir = ?");
+    q.addBindValue(path);
+    q.exec();
+
+    q.prepare("INSERT INTO files (dir, name, size, mtime, format) "
+              "VALUES (?, ?, ?, ?, ?)");
+    for (auto iter = formats.cbegin(); iter != formats.cend(); ++iter)
+    {
+        q.bindValue(0, path);
+        q.bindValue(1, iter.key());
+        q.bindValue(2, iter->size);
+        q.bindValue(3, iter->mtime);
+        q.bindValue(4, iter->format);
+        q.exec();
+    }
+    db.commit();
+}
+
+bool
+Catalog::findPages(const QFileInfo &info, QVector<Page> &pages)
+{
+    Catalog *c = local();
+    if (!c) return false;
+
+    QSqlQuery q(QSqlDatabase::database(c->conn, false));
+    q.setForwardOnly(true);
+    q.prepare("SELECT key, width, height, format, bytes FROM pages "
+              "WHERE path = ? AND size = ? AND mtime = ?");
+    q.addBindValue(info.absoluteFilePath());
+    q.addBindValue(info.size());
+    q.addBindValue(modifiedTime(info));
+    if (!q.exec()) return false;
+    while (q.next())
+    {
+        Page p;
+        p.key = q.value(0).toString();
+        p.size = QSize(q.value(1).toInt(), q.value(2).toInt());
+        p.format = q.value(3).toByteArray();
+        p.bytes = q.value(4).toLongLong();
+        pages << p;
+    }
+    return !pages.empty();
+}
+
+void
+Catalog::storePages(const QFileInfo &info, const QVector<Page> &pages)
+{
+    if (pages.empty()) return;
+    Catalog *c = local();
+    if (!c) return;
+
+    QSqlDatabase db = QSqlDatabase::database(c->conn, false);
+    const QString path = info.absoluteFilePath();
+    const qint64 mtime = modifiedTime(info);
+    db.transaction();
+    QSqlQuery q(db);
+    // 書き換えられる前のファイルのページは捨てる
+    q.prepare("DELETE FROM pages WHERE path = ? AND "
+              "(size <> ? OR mtime <> ?)");
+    q.addBindValue(path);
+    q.addBindValue(info.size());
+    q.addBindValue(mtime);
+    q.exec();
+
+    q.prepare("INSERT OR REPLACE INTO pages "
+              "(path, key, size, mtime, width, height, format, bytes) "
+              "VALUES (?, ?, ?, ?, ?, ?, ?, ?)");
+    for (auto p = pages.cbegin(); p != pages.cend(); ++p)
+    {
+        q.bindValue(0, path);
+        q.bindValue(1, p->key);
+        q.bindValue(2, info.size());
+        q.bindValue(3, mtime);
+        q.bindValue(4, p->size.width());
+        q.bindValue(5, p->size.height());
+        q.bindValue(6, p->format);
+        q.bindValue(7, p->bytes);
+        q.exec();
+    }
+    db.commit();
+}
+
+qint64
+Catalog::modifiedTime(const QFileInfo &info)
+{
+    return info.lastModified().toMSecsSinceEpoch();
+}
+
+// このスレッドの接続．開けなければnull
+Catalog *
+Catalog::local()
+{
+    if (!catalogs.hasLocalData())
+    {
+        catalogs.setLocalData(new Catalog());
+    }
+    Catalog *c = catalogs.localData();
+    return c->ok ? c : nullptr;
+}
@@ -0,0 +1,73 @@
+#ifndef CATALOG_HPP
+#define CATALOG_HPP
+
+#include <QString>
+#include <QByteArray>
+#include <QVector>
+#include <QHash>
+#include <QSize>
+#include <QFileInfo>
+#include "ArchiveIndex.hpp"
+
+// 開いたファイルを調べた結果をSQLiteに保存しておき，次に開くときに
+// 大きさと更新時刻が変わっていなければ読み直さずに使う．
+// QSqlDatabaseの接続は作ったスレッドでしか使えないので，
+// 使うスレッドごとに接続し，スレッドが終わるときに閉じる
+class Catalog
+{
+public:
+    // 書庫の索引を作り直すのに要るもの
+    struct Archive
+    {
+        bool zip;           // 中央ディレクトリから読むzipか
+        int format;         // ヘッダの位置が分かる形式か0
+        bool streaming;
+        bool solid;
+        QVector<ArchiveIndex::Entry> entries;
+    };
+    // 先頭バイトから判定したファイルのフォーマット
+    struct FileFormat
+    {
+        qint64 size;
+        qint64 mtime;
+        QByteArray format;  // 画像でなければ空
+    };
+    // ヘッダから得たページの情報
+    struct Page
+    {
+        QString key;
+        QSize size;
+        QByteArray format;
+        qint64 bytes;
+    };
+
+    ~Catalog();
+
+    static bool findArchive(const QFileInfo &info, Archive &archive);
+    static void storeArchive(const QFileInfo &info, const Archive &archive);
+    // ディレクトリの中のファイルのフォーマット．キーはファイル名
+    static QHash<QString, FileFormat> findFormats(const QString &dir);
+    static void storeFormats(const QString &dir,
+            const QHash<QString, FileFormat> &formats);
+    // pathのファイル(書庫ならその中のエントリ)のページ
+    static bool findPages(const QFileInfo &info, QVector<Page> &pages);
+    static void storePages(const QFileInfo &info,
+            const QVector<Page> &pages);
+
+    static qint64 modifiedTime(const QFileInfo &info);
+
+private:
+    Catalog();
+    Catalog(const Catalog &) = delete;
+    Catalog &operator=(const Catalog &) = delete;
+
+    QString conn;
+    bool ok;
+
+    // 保存する内容を変えたら増やす
+    static const int version = 1;
+
+    static Catalog *local();
+};
+
+#endif // CATALOG_HPP
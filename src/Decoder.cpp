@@ -0,0 +1,458 @@
+#include <QImageReader>
+#include <QBuffer>
+#include <QMutex>
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include "Decoder.hpp"
+#include "JpegDecoder.hpp"
+#include "WebpDecoder.hpp"
+#include "AvifDecoder.hpp"
+#include "JpegXLDecoder.hpp"
+
+/******************* sniff *******************/
+static bool
+sniff_jpeg(const uchar *p, qint64 len)
+{
+    return len >= 3 && p[0] == 0xFF && p[1] == 0xD8 && p[2] == 0xFF;
+}
+
+static bool
+sniff_png(const uchar *p, qint64 len)
+{
+    return len >= 8 && memcmp(p, "\x89PNG\r\n\x1a\n", 8) == 0;
+}
+
+static bool
+sniff_gif(const uchar *p, qint64 len)
+{
+    return len >= 6 && (memcmp(p, "GIF87a", 6) == 0 ||
+            memcmp(p, "GIF89a", 6) == 0);
+}
+
+static bool
+sniff_tiff(const uchar *p, qint64 len)
+{
+    return len >= 4 && (memcmp(p, "II*\0", 4) == 0 ||
+            memcmp(p, "MM\0*", 4) == 0);
+}
+
+static bool
+sniff_bmp(const uchar *p, qint64 len)
+{
+    // "BM"だけでは誤判定しやすいので予約領域(0)も確認する
+    return len >= 10 && p[0] == 'B' && p[1] == 'M' &&
+        p[6] == 0 && p[7] == 0 && p[8] == 0 && p[9] == 0;
+}
+
+static bool
+sniff_pnm(const uchar *p, qint64 len, char a, char b)
+{
+    return len >= 3 && p[0] == 'P' && (p[1] == a || p[1] == b) &&
+        isspace(p[2]);
+}
+
+static bool
+sniff_pbm(const uchar *p, qint64 len)
+{
+    return sniff_pnm(p, len, '1', '4');
+}
+
+static bool
+sniff_pgm(const uchar *p, qint64 len)
+{
+    return sniff_pnm(p, len, '2', '5');
+}
+
+static bool
+sniff_ppm(const uchar *p, qint64 len)
+{
+    return sniff_pnm(p, len, '3', '6');
+}
+
+static bool
+sniff_xpm(const uchar *p, qint64 len)
+{
+    return len >= 9 && memcmp(p, "/* XPM */", 9) == 0;
+}
+
+static bool
+sniff_xbm(const uchar *p, qint64 len)
+{
+    return len >= 8 && memcmp(p, "#define ", 8) == 0;
+}
+
+/******************* Qt *******************/
+static bool
+qt_decode(const char *format, const QByteArray &data,
+        QImage &img, int options)
+{
+    Q_UNUSED(options);
+    return img.loadFromData(data, format);
+}
+
+static bool
+qt_decode_scaled(const char *format, const QByteArray &data,
+        const QSize &size, QImage &img, int options)
+{
+    Q_UNUSED(options);
+    QBuffer buf;
+    buf.setData(data);
+    buf.open(QIODevice::ReadOnly);
+    QImageReader reader(&buf, format);
+    // JPEGのプラグインはDCTの段階で縮小する
+    reader.setScaledSize(size);
+    return reader.read(&img);
+}
+
+static bool
+qt_probe(const char *format, const QByteArray &data, QSize &size)
+{
+    QBuffer buf;
+    buf.setData(data);
+    buf.open(QIODevice::ReadOnly);
+    QImageReader reader(&buf, format);
+    size = reader.size();
+    return size.isValid();
+}
+
+/******************* jpeg *******************/
+static bool
+jpeg_decode(const char *format, const QByteArray &data,
+        QImage &img, int options)
+{
+    if (JpegDecoder::isAvailable() &&
+            JpegDecoder::decode(data, img, QImage::Format_RGB32, options))
+    {
+        return true;
+    }
+    return qt_decode(format, data, img, options);
+}
+
+static bool
+jpeg_decode_scaled(const char *format, const QByteArray &data,
+        const QSize &size, QImage &img, int options)
+{
+    QSize orig;
+    bool gray;
+    if (JpegDecoder::isAvailable() &&
+            JpegDecoder::readHeader(data, orig, gray))
+    {
+        // 要求より小さくならない範囲でDCTの縮小率を選ぶ
+        int denom = 8;
+        while (denom > 1 &&
+                ((orig.width() + denom-1) / denom < size.width() ||
+                 (orig.height() + denom-1) / denom < size.height()))
+        {
+            denom /= 2;
+        }
+        QImage out;
+        if (JpegDecoder::decodeScaled(data, out, denom,
+                    QImage::Format_RGB32, options))
+        {
+            img = (out.size() == size) ? out :
+                out.scaled(size, Qt::IgnoreAspectRatio,
+                        Qt::FastTransformation);
+            return true;
+        }
+    }
+    return qt_decode_scaled(format, data, size, img, options);
+}
+
+static bool
+jpeg_probe(const char *format, const QByteArray &data, QSize &size)
+{
+    bool gray;
+    if (JpegDecoder::isAvailable())
+    {
+        return JpegDecoder::readHeader(data, size, gray);
+    }
+    return qt_probe(format, data, size);
+}
+
+/******************* webp *******************/
+#ifdef USE_LIBWEBP
+static bool
+sniff_webp(const uchar *p, qint64 len)
+{
+    return len >= 12 && memcmp(p, "RIFF", 4) == 0 &&
+        memcmp(p+8, "WEBP", 4) == 0;
+}
+
+static bool
+webp_decode(const char *format, const QByteArray &data,
+        QImage &img, int options)
+{
+    Q_UNUSED(format);
+    Q_UNUSED(options);
+    return WebpDecoder::decode(data, img);
+}
+
+static bool
+webp_decode_scaled(const char *format, const QByteArray &data,
+        const QSize &size, QImage &img, int options)
+{
+    Q_UNUSED(format);
+    Q_UNUSED(options);
+    return WebpDecoder::decodeScaled(data, size, img);
+}
+
+static bool
+webp_probe(const char *format, const QByteArray &data, QSize &size)
+{
+    Q_UNUSED(format);
+    return WebpDecoder::readHeader(data, size);
+}
+#endif
+
+/******************* avif *******************/
+#ifdef USE_LIBAVIF
+static bool
+sniff_avif(const uchar *p, qint64 len)
+{
+    // ftypボックスのmajor brandかcompatible brandsにavifを含む
+    if (len < 12 || memcmp(p+4, "ftyp", 4) != 0) return false;
+    const qint64 boxlen = std::min<qint64>(len,
+            (qint64(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3]);
+    for (qint64 i = 8; i + 4 <= boxlen; i += 4)
+    {
+        if (i == 12) continue; // minor version
+        if (memcmp(p+i, "avif", 4) == 0 ||
+                memcmp(p+i, "avis", 4) == 0) return true;
+    }
+    return false;
+}
+
+static bool
+avif_decode(const char *format, const QByteArray &data,
+        QImage &img, int options)
+{
+    Q_UNUSED(format);
+    Q_UNUSED(options);
+    return AvifDecoder::decode(data, img);
+}
+
+static bool
+avif_probe(const char *format, const QByteArray &data, QSize &size)
+{
+    Q_UNUSED(format);
+    return AvifDecoder::readHeader(data, size);
+}
+#endif
+
+/******************* jxl *******************/
+#ifdef USE_LIBJXL
+static bool
+sniff_jxl(const uchar *p, qint64 len)
+{
+    static const uchar container[] =
+    {
+        0x00, 0x00, 0x00, 0x0C, 'J', 'X', 'L', ' ', 0x0D, 0x0A, 0x87, 0x0A,
+    };
+    if (len >= 2 && p[0] == 0xFF && p[1] == 0x0A) return true;
+    return len >= 12 && memcmp(p, container, sizeof(container)) == 0;
+}
+
+static bool
+jxl_decode(const char *format, const QByteArray &data,
+        QImage &img, int options)
+{
+    Q_UNUSED(format);
+    Q_UNUSED(options);
+    return JpegXLDecoder::decode(data, img);
+}
+
+static bool
+jxl_probe(const char *format, const QByteArray &data, QSize &size)
+{
+    Q_UNUSED(format);
+    return JpegXLDecoder::readHeader(data, size);
+}
+#endif
+
+/******************* registry *******************/
+// 先頭から順に判定するので，誤判定しやすいものほど後ろに置く
+static const Decoder::Backend backends[] =
+{
+    {"jpeg", "jpg jpeg jpe jfif", sniff_jpeg,
+        jpeg_decode, jpeg_decode_scaled, jpeg_probe, true},
+    {"png", "png", sniff_png,
+        qt_decode, qt_decode_scaled, qt_probe, true},
+#ifdef USE_LIBWEBP
+    {"webp", "webp", sniff_webp,
+        webp_decode, webp_decode_scaled, webp_probe, true},
+#endif
+#ifdef USE_LIBAVIF
+    {"avif", "avif", sniff_avif,
+        avif_decode, nullptr, avif_probe, true},
+#endif
+#ifdef USE_LIBJXL
+    {"jxl", "jxl", sniff_jxl,
+        jxl_decode, nullptr, jxl_probe, true},
+#endif
+    {"gif", "gif", sniff_gif,
+        qt_decode, qt_decode_scaled, qt_probe, true},
+    {"tiff", "tif tiff", sniff_tiff,
+        qt_decode, qt_decode_scaled, qt_probe, true},
+    {"bmp", "bmp", sniff_bmp,
+        qt_decode, qt_decode_scaled, qt_probe, true},
+    {"pbm", "pbm pnm", sniff_pbm,
+        qt_decode, qt_decode_scaled, qt_probe, true},
+    {"pgm", "pgm", sniff_pgm,
+        qt_decode, qt_decode_scaled, qt_probe, true},
+    {"ppm", "ppm", sniff_ppm,
+        qt_decode, qt_decode_scaled, qt_probe, true},
+    {"xpm", "xpm", sniff_xpm,
+        qt_decode, qt_decode_scaled, qt_probe, true},
+    {"xbm", "xbm", sniff_xbm,
+        qt_decode, qt_decode_scaled, qt_probe, true},
+};
+
+static const int backends_len = sizeof(backends) / sizeof(backends[0]);
+
+// threadsafeでないバックエンドはこのロックで直列化する
+static QMutex backend_mutex;
+
+const Decoder::Backend *
+Decoder::find(const QByteArray &format)
+{
+    for (int i = 0; i < backends_len; ++i)
+    {
+        if (format == backends[i].format) return &backends[i];
+    }
+    return nullptr;
+}
+
+const Decoder::Backend *
+Decoder::detect(const char *data, qint64 len)
+{
+    if (!data) return nullptr;
+    const uchar *p = reinterpret_cast<const uchar*>(data);
+    for (int i = 0; i < backends_len; ++i)
+    {
+        if (backends[i].sniff(p, len)) return &backends[i];
+    }
+    return nullptr;
+}
+
+QByteArray
+Decoder::detectFormat(const char *data, qint64 len)
+{
+    const Backend *b = detect(data, len);
+    return b ? QByteArray(b->format) : QByteArray();
+}
+
+static QStringList
+make_suffixes()
+{
+    QStringList list;
+    for (int i = 0; i < backends_len; ++i)
+    {
+        list << QString(backends[i].suffixes).split(' ');
+    }
+    return list;
+}
+
+const QStringList &
+Decoder::suffixes()
+{
+    // 複数のスレッドから呼ばれるので初期化は一度だけにする
+    static const QStringList list = make_suffixes();
+    return list;
+}
+
+static const Decoder::Backend *
+select_backend(const QByteArray &data, const QByteArray &format)
+{
+    const Decoder::Backend *b = Decoder::find(format);
+    if (!b) b = Decoder::detect(data.constData(), data.size());
+    return b;
+}
+
+bool
+Decoder::decode(const QByteArray &data, const QByteArray &format,
+        QImage &img, int options)
+{
+    const Backend *b = select_backend(data, format);
+    if (b)
+    {
+        bool ret;
+        if (b->threadsafe)
+        {
+            ret = b->decode(b->format, data, img, options);
+        }
+        else
+        {
+            QMutexLocker locker(&backend_mutex);
+            ret = b->decode(b->format, data, img, options);
+        }
+        if (ret) return true;
+    }
+    // 判定を誤った場合に備えてQtに任せる
+    return img.loadFromData(data);
+}
+
+bool
+Decoder::decodeScaled(const QByteArray &data, const QByteArray &format,
+        const QSize &size, QImage &img, int options)
+{
+    const Backend *b = select_backend(data, format);
+    if (b && b->decodeScaled)
+    {
+        bool ret;
+        if (b->threadsafe)
+        {
+            ret = b->decodeScaled(b->format, data, size, img, options);
+        }
+        else
+        {
+            QMutexLocker locker(&backend_mutex);
+            ret = b->decodeScaled(b->format, data, size, img, options);
+        }
+        if (ret) return true;
+    }
+
+    QImage full;
+    if (!decode(data, format, full, options)) return false;
+    img = full.scaled(size, Qt::IgnoreAspectRatio, Qt::FastTransformation);
+    return true;
+}
+
+bool
+Decoder::canStream(const QByteArray &format)
+{
+    const Backend *b = find(format);
+    return b && b->decode == qt_decode;
+}
+
+bool
+Decoder::decode(QIODevice *device, const QByteArray &format, QImage &img)
+{
+    QImageReader reader(device, format);
+    return reader.read(&img);
+}
+
+bool
+Decoder::probe(const QByteArray &data, const QByteArray &format,
+        QSize &size)
+{
+    const Backend *b = select_backend(data, format);
+    if (!b) return false;
+    if (b->threadsafe) return b->probe(b->format, data, size);
+
+    QMutexLocker locker(&backend_mutex);
+    return b->probe(b->format, data, size);
+}
+
+QImage
+Decoder::toDisplayFormat(const QImage &img)
+{
+    // RGB32もARGB32と同じ32bit/pixelなのでそのまま扱える
+    if (img.isNull() ||
+            img.format() == QImage::Format_ARGB32 ||
+            img.format() == QImage::Format_RGB32)
+    {
+        return img;
+    }
+    return img.convertToFormat(QImage::Format_ARGB32);
+}
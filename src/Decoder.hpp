@@ -0,0 +1,58 @@
+#ifndef DECODER_HPP
+#define DECODER_HPP
+
+#include <QByteArray>
+#include <QImage>
+#include <QSize>
+#include <QStringList>
+#include <QIODevice>
+
+// 画像フォーマットごとのデコーダを管理する
+class Decoder
+{
+public:
+    struct Backend
+    {
+        const char *format;          // QImageReaderと同じフォーマット名
+        const char *suffixes;        // 空白区切りの拡張子
+        bool (*sniff)(const uchar *data, qint64 len);
+        // 以下の第1引数にはformatが渡される
+        bool (*decode)(const char *format, const QByteArray &data,
+                QImage &img, int options);
+        // nullならdecodeしてから縮小する
+        bool (*decodeScaled)(const char *format, const QByteArray &data,
+                const QSize &size, QImage &img, int options);
+        bool (*probe)(const char *format, const QByteArray &data,
+                QSize &size);
+        bool threadsafe;             // 複数のスレッドから同時に呼べるか
+    };
+
+    static const Backend *find(const QByteArray &format);
+    static const Backend *detect(const char *data, qint64 len);
+
+    static QByteArray detectFormat(const char *data, qint64 len);
+    static const QStringList &suffixes();
+
+    // optionsはJpegDecoder::Optionの組み合わせ
+    static bool decode(const QByteArray &data, const QByteArray &format,
+            QImage &img, int options = 0);
+    static bool decodeScaled(const QByteArray &data,
+            const QByteArray &format, const QSize &size,
+            QImage &img, int options = 0);
+    static bool probe(const QByteArray &data, const QByteArray &format,
+            QSize &size);
+
+    // QImageReaderで読むフォーマットなら，読み込み中のデバイスから
+    // 届いた分ずつデコードできる
+    static bool canStream(const QByteArray &format);
+    static bool decode(QIODevice *device, const QByteArray &format,
+            QImage &img);
+
+    // 表示用の32bit/pixelの形式にする
+    static QImage toDisplayFormat(const QImage &img);
+
+private:
+    Decoder() = delete;
+};
+
+#endif // DECODER_HPP
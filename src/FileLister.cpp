@@ -0,0 +1,396 @@
+#include <QFileInfo>
+#include <QDirIterator>
+#include <QRunnable>
+#include <algorithm>
+#include "FileLister.hpp"
+#include "Catalog.hpp"
+
+class FileLister::DirTask : public QRunnable
+{
+public:
+    DirTask(FileLister *lister, int gen, const QSharedPointer<DirNode> &node)
+        : lister(lister), gen(gen), node(node)
+    {
+    }
+
+    void run()
+    {
+        lister->scanDir(gen, node);
+    }
+
+private:
+    FileLister *lister;
+    int gen;
+    QSharedPointer<DirNode> node;
+};
+
+FileLister::FileLister(QObject *parent)
+    : QThread(parent)
+    , reqs()
+    , results()
+    , cur_gen(0)
+    , quit(false)
+    , pool()
+    , found_dirs()
+    , inserting(false)
+{
+    pool.setMaxThreadCount(8);
+    start();
+}
+
+FileLister::~FileLister()
+{
+    mutex.lock();
+    quit = true;
+    reqs.clear();
+    cur_gen.fetchAndAddOrdered(1);
+    cond_req.wakeOne();
+    mutex.unlock();
+    // 読み終えるのを待っているところを起こす
+    scan_mutex.lock();
+    cond_scan.wakeAll();
+    scan_mutex.unlock();
+    wait();
+    pool.waitForDone();
+
+    for (auto iter = results.begin(); iter != results.end(); ++iter)
+    {
+        qDeleteAll(iter->files);
+    }
+    results.clear();
+}
+
+void
+FileLister::putRequest(const QStringList &paths, int level, bool insert)
+{
+    Request req;
+    req.gen = cur_gen.load();
+    req.paths = paths;
+    req.level = level;
+    req.insert = insert;
+
+    mutex.lock();
+    reqs << req;
+    cond_req.wakeOne();
+    mutex.unlock();
+}
+
+void
+FileLister::clear()
+{
+    mutex.lock();
+    cur_gen.fetchAndAddOrdered(1);
+    reqs.clear();
+    for (auto iter = results.begin(); iter != results.end(); ++iter)
+    {
+        qDeleteAll(iter->files);
+    }
+    results.clear();
+    mutex.unlock();
+
+    // 読み終えるのを待っているところを起こす
+    scan_mutex.lock();
+    cond_scan.wakeAll();
+    scan_mutex.unlock();
+}
+
+void
+FileLister::setScanThreads(int n)
+{
+    pool.setMaxThreadCount(std::max(1, n));
+}
+
+int
+FileLister::getScanThreads() const
+{
+    return pool.maxThreadCount();
+}
+
+QVector<FileLister::Result>
+FileLister::takeResults()
+{
+    mutex.lock();
+    QVector<Result> ret;
+    ret.swap(results);
+    mutex.unlock();
+    return ret;
+}
+
+void
+FileLister::run()
+{
+    for (;;)
+    {
+        mutex.lock();
+        while (reqs.empty() && !quit)
+        {
+            cond_req.wait(&mutex);
+        }
+        if (quit)
+        {
+            mutex.unlock();
+            return;
+        }
+        Request req = reqs.takeFirst();
+        mutex.unlock();
+
+        QVector<ImageFile*> files;
+        bool sent = false;
+        found_dirs.clear();
+        inserting = req.insert;
+        listPaths(req.gen, req.paths, req.level, files, sent);
+        flush(req.gen, files, sent, true);
+    }
+}
+
+bool
+FileLister::isCanceled(int gen) const
+{
+    return cur_gen.load() != gen;
+}
+
+void
+FileLister::listPaths(int gen, const QStringList &paths, int level,
+        QVector<ImageFile*> &files, bool &sent)
+{
+    // ディレクトリは先にまとめて読み始めておく
+    QVector<QSharedPointer<DirNode>> dirs(paths.count());
+    for (int i = 0; i < paths.count(); ++i)
+    {
+        if (level > 0 && QFileInfo(paths[i]).isDir())
+        {
+            dirs[i] = startScan(gen, paths[i], level - 1);
+        }
+    }
+
+    for (int i = 0; i < paths.count(); ++i)
+    {
+        if (isCanceled(gen)) return;
+        if (dirs[i])
+        {
+            listDir(gen, dirs[i], files, sent);
+        }
+        else if (QFileInfo(paths[i]).isFile())
+        {
+            const QByteArray fmt = ImageFile::detectFormat(paths[i]);
+            listFile(gen, paths[i], fmt,
+                    ImageFile::isReadableArchiveFile(paths[i]), files, sent);
+        }
+    }
+}
+
+QSharedPointer<FileLister::DirNode>
+FileLister::startScan(int gen, const QString &dir, int level)
+{
+    QSharedPointer<DirNode> node(new DirNode);
+    node->path = dir;
+    node->level = level;
+    node->ready = false;
+    // 深いものほど先に読むと，たどる順に近くなる
+    pool.start(new DirTask(this, gen, node), -level);
+    return node;
+}
+
+void
+FileLister::scanDir(int gen, const QSharedPointer<DirNode> &node)
+{
+    QVector<DirEntry> entries;
+    if (!isCanceled(gen))
+    {
+        // 種類はディレクトリを読んだときに分かるものを使い，
+        // 正規化したパスを求めるなどの余計なstatをしない
+        QVector<QFileInfo> infos;
+        QDirIterator iter(node->path, QDir::AllEntries | QDir::NoDotAndDotDot);
+        while (iter.hasNext())
+        {
+            iter.next();
+            infos << iter.fileInfo();
+            node->names << iter.fileName();
+        }
+        std::stable_sort(infos.begin(), infos.end(),
+                [](const QFileInfo &a, const QFileInfo &b)
+                {
+                    return a.fileName().compare(b.fileName(),
+                            Qt::CaseInsensitive) < 0;
+                });
+
+        // 前に判定したフォーマットは大きさと更新時刻が同じなら使う
+        const QHash<QString, Catalog::FileFormat> known =
+            Catalog::findFormats(node->path);
+        QHash<QString, Catalog::FileFormat> formats;
+        bool changed = false;
+
+        for (auto info = infos.cbegin(); info != infos.cend(); ++info)
+        {
+            if (isCanceled(gen)) break;
+            DirEntry e;
+            e.path = info->filePath();
+            e.archive = false;
+            if (info->isDir())
+            {
+                // リンクをたどらなければ同じディレクトリを巡回しない
+                if (node->level <= 0 || info->isSymLink()) continue;
+                e.dir = startScan(gen, e.path, node->level - 1);
+            }
+            else
+            {
+                Catalog::FileFormat f;
+                f.size = info->size();
+                f.mtime = Catalog::modifiedTime(*info);
+                auto k = known.constFind(info->fileName());
+                if (k != known.constEnd() &&
+                        k->size == f.size && k->mtime == f.mtime)
+                {
+                    f.format = k->format;
+                }
+                else
+                {
+                    // 先頭バイトを読むのもここで並行して済ませる
+                    f.format = ImageFile::detectFormat(e.path);
+                    changed = true;
+                }
+                formats.insert(info->fileName(), f);
+
+                e.format = f.format;
+                if (e.format.isEmpty() &&
+                        !ImageFile::isReadableImageFile(e.path))
+                {
+                    e.archive = ImageFile::isReadableArchiveFile(e.path);
+                    if (!e.archive) continue;
+                }
+            }
+            entries << e;
+        }
+
+        if (!isCanceled(gen) && (changed || formats.count() != known.count()))
+        {
+            Catalog::storeFormats(node->path, formats);
+        }
+    }
+
+    scan_mutex.lock();
+    node->entries.swap(entries);
+    node->ready = true;
+    cond_scan.wakeAll();
+    scan_mutex.unlock();
+}
+
+void
+FileLister::listDir(int gen, const QSharedPointer<DirNode> &node,
+        QVector<ImageFile*> &files, bool &sent)
+{
+    scan_mutex.lock();
+    while (!node->ready && !isCanceled(gen))
+    {
+        cond_scan.wait(&scan_mutex);
+    }
+    scan_mutex.unlock();
+    if (isCanceled(gen)) return;
+
+    Dir dir;
+    dir.path = node->path;
+    dir.level = node->level;
+    dir.names = node->names;
+    found_dirs << dir;
+
+    for (auto e = node->entries.cbegin(); e != node->entries.cend(); ++e)
+    {
+        if (isCanceled(gen)) return;
+        if (e->dir)
+        {
+            listDir(gen, e->dir, files, sent);
+        }
+        else
+        {
+            listFile(gen, e->path, e->format, e->archive, files, sent);
+        }
+    }
+}
+
+void
+FileLister::listFile(int gen, const QString &path, const QByteArray &fmt,
+        bool archive, QVector<ImageFile*> &files, bool &sent)
+{
+    if (!fmt.isEmpty() || ImageFile::isReadableImageFile(path))
+    {
+        // 複数ページのTIFFはページごとに並べる
+        QVector<ImageFile*> pages = ImageFile::openPages(path, fmt);
+        if (pages.empty())
+        {
+            files << new ImageFile(path, fmt);
+        }
+        else
+        {
+            files << pages;
+        }
+        flush(gen, files, sent, false);
+    }
+    else if (archive)
+    {
+        // 並び順が変わらないように先に見つけた分を渡しておく
+        flush(gen, files, sent, true);
+        listArchive(gen, path, sent);
+    }
+}
+
+void
+FileLister::listArchive(int gen, const QString &path, bool &sent)
+{
+    // 索引ができるまでのページは書庫を走査して読まれる
+    QVector<ImageFile*> files;
+    QSharedPointer<const ArchiveIndex> index = ArchiveIndex::build(path,
+            [&](const ArchiveIndex::Entry &e)
+            {
+                if (isCanceled(gen)) return false;
+                files << new ImageFile(path, e.name, e.format);
+                if (files.count() >= (sent ? batch_size : 1))
+                {
+                    putResult(gen, path, files,
+                            QSharedPointer<const ArchiveIndex>(), false);
+                    sent = true;
+                }
+                return true;
+            });
+
+    // 書庫の中の書庫は索引ができてから開く
+    if (index) files << ImageFile::openNestedArchives(path, index);
+    putResult(gen, path, files, index, true);
+}
+
+void
+FileLister::flush(int gen, QVector<ImageFile*> &files, bool &sent,
+        bool force)
+{
+    if (files.empty() && found_dirs.empty()) return;
+    if (force || files.count() >= (sent ? batch_size : 1))
+    {
+        putResult(gen, QString(), files,
+                QSharedPointer<const ArchiveIndex>(), true);
+        sent = true;
+    }
+}
+
+void
+FileLister::putResult(int gen, const QString &archive,
+        QVector<ImageFile*> &files,
+        const QSharedPointer<const ArchiveIndex> &index, bool done)
+{
+    mutex.lock();
+    if (isCanceled(gen))
+    {
+        mutex.unlock();
+        qDeleteAll(files);
+        files.clear();
+        return;
+    }
+    Result r;
+    r.archive = archive;
+    r.files.swap(files);
+    r.index = index;
+    r.done = done;
+    r.dirs.swap(found_dirs);
+    r.insert = inserting;
+    results << r;
+    mutex.unlock();
+    emit listed();
+}
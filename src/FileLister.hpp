@@ -0,0 +1,128 @@
+#ifndef FILELISTER_HPP
+#define FILELISTER_HPP
+
+#include <QThread>
+#include <QVector>
+#include <QString>
+#include <QStringList>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QAtomicInt>
+#include <QSharedPointer>
+#include <QThreadPool>
+#include "ImageFile.hpp"
+#include "ArchiveIndex.hpp"
+
+// 開くファイルやディレクトリをバックグラウンドでたどって一覧を作る．
+// 見つけたページは全体をたどり終えるのを待たずに少しずつ渡し，
+// 書庫のエントリも索引が出来上がる前から渡していく．
+// ディレクトリは見つけた順にスレッドプールで並行して読んでおき，
+// 渡す順番はサブディレクトリを名前順にたどったときと同じにする
+class FileLister : public QThread
+{
+    Q_OBJECT
+public:
+    // たどったディレクトリ．変更を監視するのに使う
+    struct Dir
+    {
+        QString path;
+        int level;              // この下をたどる深さ
+        QStringList names;      // 読んだときにあったエントリ
+    };
+    struct Result
+    {
+        // 書庫のエントリならその書庫．ファイルなら空
+        QString archive;
+        QVector<ImageFile*> files;  // 受け取った側が解放する
+        // 書庫を走査し終えたときの索引．doneでなければnull
+        QSharedPointer<const ArchiveIndex> index;
+        bool done;
+        QVector<Dir> dirs;
+        // 末尾に追加せずに名前順の位置に入れるファイルか
+        bool insert;
+    };
+
+    explicit FileLister(QObject *parent = 0);
+    ~FileLister();
+
+    // levelはディレクトリをたどる深さ．insertならResult::insertを立てる
+    void putRequest(const QStringList &paths, int level,
+            bool insert = false);
+    // たどっている途中のものも含めて要求を取り消す
+    void clear();
+    QVector<Result> takeResults();
+
+    // 同時に読むディレクトリの数
+    void setScanThreads(int n);
+    int getScanThreads() const;
+
+signals:
+    // takeResultsで受け取れるものができた
+    void listed();
+
+protected:
+    void run();
+
+private:
+    struct Request
+    {
+        int gen;
+        QStringList paths;
+        int level;
+        bool insert;
+    };
+
+    // 読み終えたディレクトリの中身．ファイルは種類も調べておく
+    struct DirNode;
+    struct DirEntry
+    {
+        QString path;
+        QByteArray format;      // 画像ならそのフォーマット
+        bool archive;
+        QSharedPointer<DirNode> dir;    // たどるサブディレクトリ
+    };
+    struct DirNode
+    {
+        QString path;
+        int level;              // この下をたどる深さ
+        QVector<DirEntry> entries;
+        QStringList names;
+        bool ready;
+    };
+    class DirTask;
+
+    QVector<Request> reqs;
+    QVector<Result> results;
+    QMutex mutex;
+    QWaitCondition cond_req;
+    QAtomicInt cur_gen;
+    bool quit;
+    QThreadPool pool;
+    QMutex scan_mutex;
+    QWaitCondition cond_scan;   // DirNodeを読み終えた
+    // 以下はrunのスレッドだけが使う
+    QVector<Dir> found_dirs;    // まだ渡していないディレクトリ
+    bool inserting;             // 処理中の要求のinsert
+
+    // 最初のページはすぐに，その後はこの数ずつ渡す
+    static const int batch_size = 256;
+
+    bool isCanceled(int gen) const;
+    void listPaths(int gen, const QStringList &paths, int level,
+            QVector<ImageFile*> &files, bool &sent);
+    QSharedPointer<DirNode> startScan(int gen, const QString &dir,
+            int level);
+    void scanDir(int gen, const QSharedPointer<DirNode> &node);
+    void listDir(int gen, const QSharedPointer<DirNode> &node,
+            QVector<ImageFile*> &files, bool &sent);
+    void listFile(int gen, const QString &path, const QByteArray &fmt,
+            bool archive, QVector<ImageFile*> &files, bool &sent);
+    void listArchive(int gen, const QString &path, bool &sent);
+    void flush(int gen, QVector<ImageFile*> &files, bool &sent,
+            bool force);
+    void putResult(int gen, const QString &archive,
+            QVector<ImageFile*> &files,
+            const QSharedPointer<const ArchiveIndex> &index, bool done);
+};
+
+#endif // FILELISTER_HPP
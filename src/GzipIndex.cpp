@@ -0,0 +1,216 @@
+#include <algorithm>
+#include <cstring>
+#include "GzipIndex.hpp"
+
+GzipIndex::Builder::Builder(const QString &path)
+    : file(path)
+    , init(false)
+    , done(false)
+    , in(1024*128, Qt::Uninitialized)
+    , window(window_size, Qt::Uninitialized)
+    , pending(0)
+    , totin(0)
+    , totout(0)
+    , last(0)
+    , index(new GzipIndex(path))
+{
+    strm.zalloc = Z_NULL;
+    strm.zfree = Z_NULL;
+    strm.opaque = Z_NULL;
+    strm.next_in = Z_NULL;
+    strm.avail_in = 0;
+    strm.next_out = (Bytef *)window.data();
+    strm.avail_out = window_size;
+    // 47はgzipのヘッダを読ませる指定
+    init = file.open(QIODevice::ReadOnly) &&
+        inflateInit2(&strm, 47) == Z_OK;
+}
+
+GzipIndex::Builder::~Builder()
+{
+    if (init) inflateEnd(&strm);
+}
+
+qint64
+GzipIndex::Builder::read(char *buf, qint64 len)
+{
+    if (!init) return -1;
+
+    qint64 n = 0;
+    while (n < len)
+    {
+        // 展開済みでまだ渡していない分
+        const int end = window_size - strm.avail_out;
+        if (pending < end)
+        {
+            const qint64 c = std::min<qint64>(end - pending, len - n);
+            std::memcpy(buf + n, window.constData() + pending, c);
+            pending += c;
+            n += c;
+            continue;
+        }
+        if (done) break;
+
+        if (strm.avail_out == 0)
+        {
+            strm.next_out = (Bytef *)window.data();
+            strm.avail_out = window_size;
+            pending = 0;
+        }
+        if (strm.avail_in == 0)
+        {
+            const qint64 r = file.read(in.data(), in.size());
+            if (r <= 0) return -1;
+            strm.next_in = (Bytef *)in.data();
+            strm.avail_in = r;
+        }
+
+        const uInt avail_in = strm.avail_in;
+        const uInt avail_out = strm.avail_out;
+        const int ret = inflate(&strm, Z_BLOCK);
+        totin += avail_in - strm.avail_in;
+        totout += avail_out - strm.avail_out;
+        if (ret == Z_STREAM_END)
+        {
+            done = true;
+            continue;
+        }
+        if (ret != Z_OK) return -1;
+
+        // ブロックの境目でだけ途中から展開を始められる
+        if ((strm.data_type & 128) && !(strm.data_type & 64) &&
+                (totout == 0 || totout - last > span))
+        {
+            addPoint();
+        }
+    }
+    return n;
+}
+
+QSharedPointer<GzipIndex>
+GzipIndex::Builder::finish()
+{
+    // 書庫の終わりの後ろに残っている分も読んでおく
+    QByteArray buf(1024*128, Qt::Uninitialized);
+    qint64 n;
+    while ((n = read(buf.data(), buf.size())) > 0) {}
+    if (n < 0 || !done) return QSharedPointer<GzipIndex>();
+    return index;
+}
+
+void
+GzipIndex::Builder::addPoint()
+{
+    Point p;
+    p.out = totout;
+    p.in = totin;
+    p.bits = strm.data_type & 7;
+
+    // windowは輪になっているので古い方から並べ直す
+    const int end = window_size - strm.avail_out;
+    if (totout >= window_size)
+    {
+        p.window = window.mid(end) + window.left(end);
+    }
+    else
+    {
+        p.window = window.left(end);
+    }
+    index->points << p;
+    last = totout;
+}
+
+GzipIndex::GzipIndex(const QString &path)
+    : gzip_path(path)
+    , points()
+{
+}
+
+bool
+GzipIndex::isGzip(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) return false;
+    const QByteArray magic = file.read(2);
+    return magic.size() == 2 &&
+        uchar(magic[0]) == 0x1f && uchar(magic[1]) == 0x8b;
+}
+
+bool
+GzipIndex::read(qint64 offset, qint64 len,
+        const ImageFile::BlockReader &reader) const
+{
+    auto iter = std::upper_bound(points.cbegin(), points.cend(), offset,
+            [](qint64 v, const Point &p)
+            {
+                return v < p.out;
+            });
+    if (iter == points.cbegin()) return false;
+    const Point &p = *(iter - 1);
+
+    QFile file(gzip_path);
+    if (!file.open(QIODevice::ReadOnly) ||
+            !file.seek(p.in - (p.bits ? 1 : 0)))
+    {
+        return false;
+    }
+
+    z_stream strm;
+    strm.zalloc = Z_NULL;
+    strm.zfree = Z_NULL;
+    strm.opaque = Z_NULL;
+    strm.next_in = Z_NULL;
+    strm.avail_in = 0;
+    if (inflateInit2(&strm, -MAX_WBITS) != Z_OK) return false;
+    if (p.bits)
+    {
+        char c;
+        if (!file.getChar(&c))
+        {
+            inflateEnd(&strm);
+            return false;
+        }
+        inflatePrime(&strm, p.bits, uchar(c) >> (8 - p.bits));
+    }
+    if (!p.window.isEmpty())
+    {
+        inflateSetDictionary(&strm,
+                (const Bytef *)p.window.constData(), p.window.size());
+    }
+
+    QByteArray in(1024*128, Qt::Uninitialized);
+    QByteArray out(1024*256, Qt::Uninitialized);
+    qint64 skip = offset - p.out;
+    qint64 remain = len;
+    bool aborted = false;
+    int ret = Z_OK;
+    while (remain > 0 && ret != Z_STREAM_END && !aborted)
+    {
+        if (strm.avail_in == 0)
+        {
+            const qint64 r = file.read(in.data(), in.size());
+            if (r <= 0) break;
+            strm.next_in = (Bytef *)in.data();
+            strm.avail_in = r;
+        }
+        strm.next_out = (Bytef *)out.data();
+        strm.avail_out = out.size();
+        ret = inflate(&strm, Z_NO_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END) break;
+
+        // チェックポイントから目的の位置までは捨てる
+        const char *b = out.constData();
+        qint64 n = out.size() - strm.avail_out;
+        const qint64 s = std::min(skip, n);
+        skip -= s;
+        b += s;
+        n = std::min(n - s, remain);
+        if (n > 0)
+        {
+            remain -= n;
+            aborted = !reader(b, n);
+        }
+    }
+    inflateEnd(&strm);
+    return remain == 0 && !aborted;
+}
@@ -0,0 +1,73 @@
+#ifndef GZIPINDEX_HPP
+#define GZIPINDEX_HPP
+
+#include <QString>
+#include <QByteArray>
+#include <QVector>
+#include <QFile>
+#include <QSharedPointer>
+#include <zlib.h>
+#include "ImageFile.hpp"
+
+// gzipの途中から展開を始めるためのチェックポイント(zlibのzranと同じ方法)．
+// 数MiBごとのブロックの境目で，入力の位置と直前32KiBの出力を覚えておき，
+// 展開後の任意の位置を一番近いチェックポイントから展開して読む
+class GzipIndex
+{
+public:
+    // 先頭から順に展開しながらチェックポイントを作る
+    class Builder
+    {
+    public:
+        explicit Builder(const QString &path);
+        ~Builder();
+        Builder(const Builder &) = delete;
+        Builder &operator=(const Builder &) = delete;
+
+        // 展開したデータを読む．終わりなら0，壊れていれば-1
+        qint64 read(char *buf, qint64 len);
+        // 最後まで読み終えていなければnull
+        QSharedPointer<GzipIndex> finish();
+
+    private:
+        QFile file;
+        z_stream strm;
+        bool init;
+        bool done;
+        QByteArray in;
+        QByteArray window;      // 展開先を兼ねる直前32KiBの出力
+        int pending;            // windowの中でまだ渡していない位置
+        qint64 totin;
+        qint64 totout;
+        qint64 last;            // 最後にチェックポイントを置いた位置
+        QSharedPointer<GzipIndex> index;
+
+        void addPoint();
+    };
+
+    static bool isGzip(const QString &path);
+
+    // 展開後のoffsetからlenバイトを順にreaderへ渡す
+    bool read(qint64 offset, qint64 len,
+            const ImageFile::BlockReader &reader) const;
+
+private:
+    struct Point
+    {
+        qint64 out;         // 展開後の位置
+        qint64 in;          // 入力の位置
+        int bits;           // in の直前のバイトのうち未使用のビット数
+        QByteArray window;  // 直前の出力(最大32KiB)
+    };
+
+    explicit GzipIndex(const QString &path);
+
+    QString gzip_path;
+    QVector<Point> points;
+
+    // チェックポイントの間隔
+    static const qint64 span = 4*1024*1024;
+    static const int window_size = 32*1024;
+};
+
+#endif // GZIPINDEX_HPP
@@ -1,24 +1,18 @@
+#include <QFile>
 #include <QFileInfo>
+#include <QHash>
 #include <archive.h>
 #include <archive_entry.h>
 #include <utility>
+#include <limits>
 #include "ImageFile.hpp"
-
-static const QString readable_image_suffix[] = 
-{
-    "jpg", "jpeg",
-    "png",
-    "pbm", "ppm", "pgm", "pnm",
-    "bmp",
-    "gif",
-    "tiff",
-    "xbm",
-    "xpm",
-};
+#include "Decoder.hpp"
+#include "TiffPages.hpp"
+#include "ArchiveIndex.hpp"
 
 static const QString readable_archive_suffix[] =
 {
-    "zip", "tar", "7z", "cab",
+    "zip", "tar", "7z", "cab", "rar", "gz", "tgz",
 };
 
 ImageFile::ImageFile()
@@ -26,23 +20,55 @@ ImageFile::ImageFile()
     , archive_path()
     , file_path()
     , raw_file_entry()
+    , img_format()
+    , page_no(0)
+    , page_offset(0)
+    , img_half(WHOLE)
+    , archive_index()
 {
 }
 
 ImageFile::ImageFile(const QString &path,
-        const QByteArray &entry)
+        const QByteArray &entry,
+        const QByteArray &format,
+        const QSharedPointer<const ArchiveIndex> &index)
     : ft(ARCHIVE)
     , archive_path(path)
-    , file_path(path + "/" + QString(entry))
+    , file_path((index ? index->path() : path) + "/" + QString(entry))
     , raw_file_entry(entry)
+    , img_format(format)
+    , page_no(0)
+    , page_offset(0)
+    , img_half(WHOLE)
+    , archive_index(index)
 {
 }
 
-ImageFile::ImageFile(const QString &imagefile)
+ImageFile::ImageFile(const QString &imagefile,
+        const QByteArray &format)
     : ft(RAW)
     , archive_path()
     , file_path(imagefile)
     , raw_file_entry()
+    , img_format(format)
+    , page_no(0)
+    , page_offset(0)
+    , img_half(WHOLE)
+    , archive_index()
+{
+}
+
+ImageFile::ImageFile(const QString &path, int page, qint64 offset,
+        const QByteArray &format)
+    : ft(PAGE)
+    , archive_path(path)
+    , file_path(QString("%1#%2").arg(path).arg(page + 1))
+    , raw_file_entry()
+    , img_format(format)
+    , page_no(page)
+    , page_offset(offset)
+    , img_half(WHOLE)
+    , archive_index()
 {
 }
 
@@ -51,6 +77,11 @@ ImageFile::ImageFile(const ImageFile &other)
     , archive_path(other.archive_path)
     , file_path(other.file_path)
     , raw_file_entry(other.raw_file_entry)
+    , img_format(other.img_format)
+    , page_no(other.page_no)
+    , page_offset(other.page_offset)
+    , img_half(other.img_half)
+    , archive_index(other.archive_index)
 {
 }
 
@@ -59,6 +90,11 @@ ImageFile::ImageFile(ImageFile &&other)
     , archive_path(std::move(other.archive_path))
     , file_path(std::move(other.file_path))
     , raw_file_entry(std::move(other.raw_file_entry))
+    , img_format(std::move(other.img_format))
+    , page_no(other.page_no)
+    , page_offset(other.page_offset)
+    , img_half(other.img_half)
+    , archive_index(std::move(other.archive_index))
 {
 }
 
@@ -74,6 +110,11 @@ ImageFile::operator=(const ImageFile &other)
     archive_path = other.archive_path;
     file_path = other.file_path;
     raw_file_entry = other.raw_file_entry;
+    img_format = other.img_format;
+    page_no = other.page_no;
+    page_offset = other.page_offset;
+    img_half = other.img_half;
+    archive_index = other.archive_index;
     return *this;
 }
 
@@ -84,6 +125,11 @@ ImageFile::operator=(ImageFile &&other)
     archive_path = std::move(other.archive_path);
     file_path = std::move(other.file_path);
     raw_file_entry = std::move(other.raw_file_entry);
+    img_format = std::move(other.img_format);
+    page_no = other.page_no;
+    page_offset = other.page_offset;
+    img_half = other.img_half;
+    archive_index = std::move(other.archive_index);
     return *this;
 }
 
@@ -105,6 +151,7 @@ ImageFile::physicalFilePath() const
     switch (ft)
     {
         case ARCHIVE: return archive_path;
+        case PAGE:    return archive_path;
         case RAW:     return file_path;
         default:      return QString();
     }
@@ -122,6 +169,7 @@ ImageFile::logicalFilePath() const
     switch (ft)
     {
         case ARCHIVE: return file_path;
+        case PAGE:    return file_path;
         case RAW:     return file_path;
         default:      return QString();
     }
@@ -130,7 +178,13 @@ ImageFile::logicalFilePath() const
 QString
 ImageFile::logicalFileName() const
 {
-    return QFileInfo(logicalFilePath()).fileName();
+    const QString name = QFileInfo(logicalFilePath()).fileName();
+    switch (img_half)
+    {
+        case LEFT:  return name + " (L)";
+        case RIGHT: return name + " (R)";
+        default:    return name;
+    }
 }
 
 const QByteArray&
@@ -139,37 +193,125 @@ ImageFile::rawFilePath() const
     return raw_file_entry;
 }
 
+const QByteArray &
+ImageFile::format() const
+{
+    return img_format;
+}
+
+int
+ImageFile::page() const
+{
+    return page_no;
+}
+
+qint64
+ImageFile::pageOffset() const
+{
+    return page_offset;
+}
+
+ImageFile::Half
+ImageFile::half() const
+{
+    return img_half;
+}
+
+void
+ImageFile::setHalf(Half h)
+{
+    img_half = h;
+}
+
+int
+ImageFile::archiveOrder() const
+{
+    if (!archive_index || archive_index->isRandomAccess()) return -1;
+    const ArchiveIndex::Entry *e = archive_index->find(raw_file_entry);
+    return e ? e->ordinal : -1;
+}
+
 QString
 ImageFile::createKey() const
 {
     return logicalFilePath();
 }
 
-QByteArray *
-ImageFile::readData() const
+qint64
+ImageFile::dataSize() const
 {
     switch (fileType())
     {
-        case RAW:     return readImageData();
-        case ARCHIVE: return readArchiveData();
-        case INVALID: return nullptr;
+        case RAW:
+            return QFileInfo(file_path).size();
+        case ARCHIVE:
+        {
+            const ArchiveIndex::Entry *e = archive_index ?
+                archive_index->find(raw_file_entry) : nullptr;
+            return e ? e->size : -1;
+        }
+        default:
+            return -1;
     }
-    return nullptr;
 }
 
 bool
-ImageFile::isReadableImageFile(const QString &path)
+ImageFile::readData(Data &data) const
 {
-    int len = sizeof(readable_image_suffix) / 
-        sizeof(readable_image_suffix[0]);
-    QString ext = QFileInfo(path).suffix();
-    for (int i = 0; i < len; ++i)
+    data = Data();
+    switch (fileType())
     {
-        if (ext == readable_image_suffix[i]) return true;
+        case RAW:
+        case PAGE:
+            if (mapImageData(data)) return true;
+            break;
+        case ARCHIVE:
+            // 無圧縮のエントリは書庫をマップした領域をそのまま使う
+            if (archive_index &&
+                    archive_index->mapEntry(rawFilePath(), data))
+            {
+                return true;
+            }
+            break;
+        case INVALID:
+            return false;
+    }
+
+    // 展開しながら領域を広げ直さないように先に確保しておく
+    QByteArray &bytes = data.bytes;
+    const qint64 size = dataSize();
+    if (0 < size && size <= std::numeric_limits<int>::max())
+    {
+        bytes.reserve(size);
+    }
+    bool ok = readData([&bytes](const char *buf, qint64 len)
+    {
+        bytes.append(buf, len);
+        return true;
+    });
+    return ok && !bytes.isEmpty();
+}
+
+bool
+ImageFile::readData(const BlockReader &reader) const
+{
+    switch (fileType())
+    {
+        case RAW:     return readImageData(reader);
+        case PAGE:    return readImageData(reader);
+        case ARCHIVE: return readArchiveData(reader);
+        case INVALID: return false;
     }
     return false;
 }
 
+bool
+ImageFile::isReadableImageFile(const QString &path)
+{
+    return Decoder::suffixes().contains(QFileInfo(path).suffix(),
+            Qt::CaseInsensitive);
+}
+
 bool
 ImageFile::isReadableArchiveFile(const QString &path)
 {
@@ -178,24 +320,35 @@ ImageFile::isReadableArchiveFile(const QString &path)
     QString ext = QFileInfo(path).suffix();
     for (int i = 0; i < len; ++i)
     {
-        if (ext == readable_archive_suffix[i]) return true;
+        if (ext.compare(readable_archive_suffix[i],
+                    Qt::CaseInsensitive) == 0) return true;
     }
     return false;
 }
 
+QByteArray
+ImageFile::detectFormat(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) return QByteArray();
+
+    char buf[16];
+    qint64 len = file.read(buf, sizeof(buf));
+    return Decoder::detectFormat(buf, len);
+}
+
 const QString &
 ImageFile::readableFormatExt()
 {
     static QString extlist;
     if (extlist.isNull())
     {
-        int len_i = sizeof(readable_image_suffix) / 
-            sizeof(readable_image_suffix[0]);
+        const QStringList &image_suffix = Decoder::suffixes();
         extlist = "Images (";
-        for (int i = 0; i < len_i; ++i)
+        for (auto iter = image_suffix.cbegin();
+                iter != image_suffix.cend(); ++iter)
         {
-            extlist += QString("*.%1 ")
-                .arg(readable_image_suffix[i]);
+            extlist += QString("*.%1 ").arg(*iter);
         }
         extlist += ")\n";
 
@@ -213,10 +366,105 @@ ImageFile::readableFormatExt()
 }
 
 QVector<ImageFile*>
-ImageFile::openArchive(const QString &path)
+ImageFile::openNestedArchives(const QString &path,
+        const QSharedPointer<const ArchiveIndex> &index)
 {
     QVector<ImageFile*> files;
-    if (!isReadableArchiveFile(path)) return files;
+    const QVector<ArchiveIndex::Entry> &entries = index->entries();
+    for (auto iter = entries.cbegin(); iter != entries.cend(); ++iter)
+    {
+        if (!iter->nested) continue;
+        QSharedPointer<const ArchiveIndex> inner =
+            ArchiveIndex::build(index, iter->name);
+        if (inner) openArchiveEntries(path, inner, 1, files);
+    }
+    return files;
+}
+
+void
+ImageFile::setArchiveIndex(const QSharedPointer<const ArchiveIndex> &index)
+{
+    archive_index = index;
+}
+
+const QSharedPointer<const ArchiveIndex> &
+ImageFile::archiveIndex() const
+{
+    return archive_index;
+}
+
+bool
+ImageFile::isSameArchive(const ImageFile &other) const
+{
+    return ft == ARCHIVE && other.ft == ARCHIVE &&
+        archive_path == other.archive_path &&
+        archive_index == other.archive_index;
+}
+
+void
+ImageFile::openArchiveEntries(const QString &path,
+        const QSharedPointer<const ArchiveIndex> &index, int depth,
+        QVector<ImageFile*> &files)
+{
+    const QVector<ArchiveIndex::Entry> &entries = index->entries();
+    for (auto iter = entries.cbegin(); iter != entries.cend(); ++iter)
+    {
+        if (!iter->nested)
+        {
+            files << new ImageFile(path, iter->name, iter->format, index);
+            continue;
+        }
+
+        // 書庫の中の書庫は一時ファイルに展開せずメモリ上で開く
+        if (depth >= max_nested_depth) continue;
+        QSharedPointer<const ArchiveIndex> inner =
+            ArchiveIndex::build(index, iter->name);
+        if (inner) openArchiveEntries(path, inner, depth + 1, files);
+    }
+}
+
+QVector<ImageFile*>
+ImageFile::openPages(const QString &path, const QByteArray &format)
+{
+    QVector<ImageFile*> files;
+    if (format != "tiff") return files;
+
+    // 1ページしかなければ普通のファイルとして扱う
+    const QVector<qint64> offsets = TiffPages::index(path);
+    if (offsets.count() < 2) return files;
+
+    for (int i = 0; i < offsets.count(); ++i)
+    {
+        files << new ImageFile(path, i, offsets[i], format);
+    }
+    return files;
+}
+
+bool
+ImageFile::readArchiveHeads(const QVector<ImageFile> &files,
+        qint64 maxlen, QVector<QByteArray> &heads,
+        QVector<qint64> &sizes)
+{
+    heads = QVector<QByteArray>(files.count());
+    sizes = QVector<qint64>(files.count(), -1);
+    if (files.empty()) return true;
+
+    // filesはすべて同じ書庫のエントリであること
+    QHash<QByteArray, int> wanted;
+    for (int i = 0; i < files.count(); ++i)
+    {
+        // 直接読めるエントリは書庫を走査しない
+        const QSharedPointer<const ArchiveIndex> &index =
+            files[i].archive_index;
+        if (index && index->readHead(files[i].rawFilePath(), maxlen, heads[i]))
+        {
+            const ArchiveIndex::Entry *e = index->find(files[i].rawFilePath());
+            sizes[i] = e->size;
+            continue;
+        }
+        wanted.insert(files[i].rawFilePath(), i);
+    }
+    if (wanted.isEmpty()) return true;
 
     struct archive *a;
 
@@ -224,49 +472,96 @@ ImageFile::openArchive(const QString &path)
     archive_read_support_filter_all(a);
     archive_read_support_format_all(a);
     int r = archive_read_open_filename(a,
-            path.toLocal8Bit().constData(), 1024*128);
+            files[0].physicalFilePath().toLocal8Bit().constData(),
+            1024*128);
     if (r != ARCHIVE_OK)
     {
         fprintf(stderr, "%s\n", archive_error_string(a));
         archive_read_free(a);
-        return files;
+        return false;
     }
 
     struct archive_entry *ae;
-    while (archive_read_next_header(a, &ae) == ARCHIVE_OK)
+    int remain = wanted.count();
+    while (remain > 0 && archive_read_next_header(a, &ae) == ARCHIVE_OK)
     {
-        QByteArray raw_entry(archive_entry_pathname(ae));
-        QString entry_name(raw_entry);
-        if (ImageFile::isReadableImageFile(entry_name))
+        QByteArray entry(archive_entry_pathname(ae));
+        auto iter = wanted.constFind(entry);
+        if (iter == wanted.constEnd()) continue;
+
+        const int i = iter.value();
+        if (archive_entry_size_is_set(ae))
         {
-            archive_read_data_skip(a);
-            ImageFile *imgfile = new ImageFile(path, raw_entry);
-            files << imgfile;
+            sizes[i] = archive_entry_size(ae);
         }
-    }
 
-    r = archive_read_free(a);
-    if (r != ARCHIVE_OK)
-    {
-        fprintf(stderr, "%s\n", archive_error_string(a));
+        QByteArray &head = heads[i];
+        head.resize(maxlen);
+        qint64 len = 0;
+        while (len < maxlen)
+        {
+            la_ssize_t n = archive_read_data(a,
+                    head.data() + len, maxlen - len);
+            if (n <= 0) break;
+            len += n;
+        }
+        head.resize(len);
+        remain--;
     }
-    return files;
+
+    archive_read_free(a);
+    return true;
 }
 
-QByteArray *
-ImageFile::readImageData() const
+bool
+ImageFile::mapImageData(Data &data) const
+{
+    QSharedPointer<QFile> file(new QFile(physicalFilePath()));
+    if (!file->open(QIODevice::ReadOnly)) return false;
+
+    const qint64 size = file->size();
+    if (size <= 0 || size > std::numeric_limits<int>::max()) return false;
+    uchar *p = file->map(0, size);
+    if (!p) return false;
+
+    data.bytes = QByteArray::fromRawData((const char *)p, size);
+    data.map = file;
+    return true;
+}
+
+bool
+ImageFile::readImageData(const BlockReader &reader) const
 {
     QFile file(physicalFilePath());
-    if (file.open(QIODevice::ReadOnly))
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        return false;
+    }
+
+    QByteArray buf(1024*128, Qt::Uninitialized);
+    qint64 len;
+    while ((len = file.read(buf.data(), buf.size())) > 0)
     {
-        return new QByteArray(file.readAll());
+        if (!reader(buf.constData(), len))
+        {
+            return false;
+        }
     }
-    return nullptr;
+    return len == 0;
 }
 
-QByteArray *
-ImageFile::readArchiveData() const
+bool
+ImageFile::readArchiveData(const BlockReader &reader) const
 {
+    // 索引のハンドルを使い回すか，ヘッダの位置から直接読む
+    if (archive_index)
+    {
+        bool found;
+        bool ret = archive_index->readEntry(rawFilePath(), reader, found);
+        // 書庫の中の書庫はファイルを走査しても見つからない
+        if (found || archive_index->isNested()) return ret;
+    }
+
     struct archive *a;
 
     a = archive_read_new();
@@ -279,7 +574,7 @@ ImageFile::readArchiveData() const
     {
         fprintf(stderr, "%s\n", archive_error_string(a));
         archive_read_free(a);
-        return nullptr;
+        return false;
     }
 
     struct archive_entry *ae;
@@ -289,26 +584,20 @@ ImageFile::readArchiveData() const
         QByteArray entry(archive_entry_pathname(ae));
         if (s_entry == entry)
         {
-            QByteArray *data = new QByteArray();
             const void *buf;
             size_t len;
             la_int64_t offset;
 
-            while (archive_read_data_block(a, &buf, &len, &offset)
+            while ((r = archive_read_data_block(a, &buf, &len, &offset))
                     == ARCHIVE_OK)
             {
-                data->append((const char *)buf, len);
+                if (!reader((const char *)buf, len))
+                {
+                    break;
+                }
             }
             archive_read_free(a);
-            if (data->isEmpty())
-            {
-                delete data;
-                return nullptr;
-            }
-            else
-            {
-                return data;
-            }
+            return r == ARCHIVE_EOF;
         }
         else
         {
@@ -316,6 +605,5 @@ ImageFile::readArchiveData() const
         }
     }
     archive_read_free(a);
-    return nullptr;
+    return false;
 }
-
@@ -5,6 +5,11 @@
 #include <QByteArray>
 #include <QTextCodec>
 #include <QVector>
+#include <QSharedPointer>
+#include <functional>
+
+class QFile;
+class ArchiveIndex;
 
 class ImageFile
 {
@@ -14,10 +19,24 @@ public:
         INVALID,
         RAW,
         ARCHIVE,
+        PAGE,       // 複数ページのTIFFの1ページ
+    };
+    // 見開きの画像を分けたときにどちら側のページか
+    enum Half
+    {
+        WHOLE,
+        LEFT,
+        RIGHT,
     };
     explicit ImageFile();
-    explicit ImageFile(const QString &path, const QByteArray &entry);
-    explicit ImageFile(const QString &path);
+    explicit ImageFile(const QString &path, const QByteArray &entry,
+            const QByteArray &format,
+            const QSharedPointer<const ArchiveIndex> &index =
+                QSharedPointer<const ArchiveIndex>());
+    explicit ImageFile(const QString &path,
+            const QByteArray &format = QByteArray());
+    explicit ImageFile(const QString &path, int page, qint64 offset,
+            const QByteArray &format);
     ImageFile(const ImageFile &other);
     ImageFile(ImageFile &&other);
     virtual ~ImageFile();
@@ -34,23 +53,71 @@ public:
     QString logicalFileName() const;
 
     const QByteArray &rawFilePath() const;
+    const QByteArray &format() const;
+    int page() const;
+    qint64 pageOffset() const;
+    Half half() const;
+    void setHalf(Half h);
+    // 書庫の中で何番目のエントリか．分からないか，順に読む必要が
+    // なければ-1
+    int archiveOrder() const;
     QString createKey() const;
+    // 書庫を走査し終えてから索引を渡す
+    void setArchiveIndex(const QSharedPointer<const ArchiveIndex> &index);
+    const QSharedPointer<const ArchiveIndex> &archiveIndex() const;
+    // 同じ書庫(書庫の中の書庫なら同じ内側の書庫)のエントリか
+    bool isSameArchive(const ImageFile &other) const;
+
+    // 読み込んだブロックを順に渡す．falseを返すと読み込みを中断する
+    typedef std::function<bool(const char *buf, qint64 len)> BlockReader;
 
-    QByteArray *readData() const; // for prefetcher
+    // ファイルの内容．mapが有効ならbytesはメモリにマップした領域を
+    // コピーせずに指しているので，mapを持っている間だけ使える
+    struct Data
+    {
+        QByteArray bytes;
+        QSharedPointer<QFile> map;
+    };
+
+    // 読み込むデータの大きさ．分からなければ-1
+    qint64 dataSize() const;
+    bool readData(Data &data) const; // for prefetcher
+    bool readData(const BlockReader &reader) const;
 
     static bool isReadableImageFile(const QString &path);
     static bool isReadableArchiveFile(const QString &path);
+    static QByteArray detectFormat(const QString &path);
     static const QString &readableFormatExt();
-    static QVector<ImageFile*> openArchive(const QString &path);
+    // indexの中の書庫のエントリだけを開く
+    static QVector<ImageFile*> openNestedArchives(const QString &path,
+            const QSharedPointer<const ArchiveIndex> &index);
+    static QVector<ImageFile*> openPages(const QString &path,
+            const QByteArray &format);
+    static bool readArchiveHeads(const QVector<ImageFile> &files,
+            qint64 maxlen, QVector<QByteArray> &heads,
+            QVector<qint64> &sizes);
 
 private:
     FileType ft;
     QString archive_path;
     QString file_path;
     QByteArray raw_file_entry;
+    QByteArray img_format; // 先頭バイトから判定したフォーマット
+    int page_no;           // PAGEのときのページ番号
+    qint64 page_offset;    // PAGEのときのIFDの位置
+    Half img_half;         // 分割したページなら画像のどちら側か
+    // 同じ書庫のImageFileで共有するエントリの一覧
+    QSharedPointer<const ArchiveIndex> archive_index;
+
+    bool mapImageData(Data &data) const;
+    bool readImageData(const BlockReader &reader) const;
+    bool readArchiveData(const BlockReader &reader) const;
+    static void openArchiveEntries(const QString &path,
+            const QSharedPointer<const ArchiveIndex> &index, int depth,
+            QVector<ImageFile*> &files);
 
-    QByteArray *readImageData() const;
-    QByteArray *readArchiveData() const;
+    // 書庫の中の書庫をたどる深さ
+    static const int max_nested_depth = 2;
 };
 
 #endif // IMAGEFILE_HPP
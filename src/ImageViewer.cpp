@@ -12,9 +12,17 @@ ImageViewer::ImageViewer(QWidget *parent)
             &plmodel, SLOT(prevImage()));
     connect(this, SIGNAL(changeNumOfImages(int)),
             &plmodel, SLOT(changeNumOfImages(int)));
+    connect(this, SIGNAL(changeRightbinding(bool)),
+            &plmodel, SLOT(changeRightbinding(bool)));
 
     connect(&plmodel, SIGNAL(changeImages(const QImage &, const QImage &)),
             this, SLOT(showImages(const QImage &, const QImage &)));
+    connect(&plmodel, SIGNAL(updateImages(const QImage &, const QImage &)),
+            this, SLOT(updateImages(const QImage &, const QImage &)));
+    connect(&plmodel, SIGNAL(changePageSizes(const QSize &, const QSize &)),
+            this, SLOT(setPageSizes(const QSize &, const QSize &)));
+    connect(&plmodel, SIGNAL(changeAnimation(int, const QByteArray &)),
+            this, SLOT(playAnimation(int, const QByteArray &)));
     connect(&plmodel, SIGNAL(changePlaylistStatus()),
             this, SLOT(changedStatus()));
 }
@@ -41,6 +49,30 @@ ImageViewer::getOpenDirLevel() const
     return plmodel.getOpenDirLevel();
 }
 
+void
+ImageViewer::setOpenDirThreads(int n)
+{
+    plmodel.setOpenDirThreads(n);
+}
+
+int
+ImageViewer::getOpenDirThreads() const
+{
+    return plmodel.getOpenDirThreads();
+}
+
+void
+ImageViewer::setWatchDirs(bool watch)
+{
+    plmodel.setWatchDirs(watch);
+}
+
+bool
+ImageViewer::getWatchDirs() const
+{
+    return plmodel.getWatchDirs();
+}
+
 void
 ImageViewer::setCacheSize(int n)
 {
@@ -53,6 +85,42 @@ ImageViewer::getCacheSize() const
     return plmodel.getCacheSize();
 }
 
+void
+ImageViewer::setPackedCacheSize(int mib)
+{
+    plmodel.setPackedCacheSize(mib);
+}
+
+int
+ImageViewer::getPackedCacheSize() const
+{
+    return plmodel.getPackedCacheSize();
+}
+
+void
+ImageViewer::setFastDecode(bool fast)
+{
+    plmodel.setFastDecode(fast);
+}
+
+bool
+ImageViewer::getFastDecode() const
+{
+    return plmodel.getFastDecode();
+}
+
+void
+ImageViewer::setSplitWidePages(bool split)
+{
+    plmodel.setSplitWidePages(split);
+}
+
+bool
+ImageViewer::getSplitWidePages() const
+{
+    return plmodel.getSplitWidePages();
+}
+
 int
 ImageViewer::countShowImages() const
 {
@@ -83,6 +151,12 @@ ImageViewer::currentFileName(int i) const
     return plmodel.currentFileName(i);
 }
 
+QSize
+ImageViewer::imageSize(int i) const
+{
+    return plmodel.imageSize(i);
+}
+
 void
 ImageViewer::setModelToItemView(QAbstractItemView *view)
 {
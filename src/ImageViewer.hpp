@@ -18,16 +18,31 @@ public:
 
     void setOpenDirLevel(int n);
     int getOpenDirLevel() const;
+    void setOpenDirThreads(int n);
+    int getOpenDirThreads() const;
+
+    void setWatchDirs(bool watch);
+    bool getWatchDirs() const;
 
     void setCacheSize(int n);
     int getCacheSize() const;
 
+    void setPackedCacheSize(int mib);
+    int getPackedCacheSize() const;
+
+    void setFastDecode(bool fast);
+    bool getFastDecode() const;
+
+    void setSplitWidePages(bool split);
+    bool getSplitWidePages() const;
+
     int countShowImages() const;
     int count() const;
     bool empty() const;
 
     int currentIndex(int i) const;
     QString currentFileName(int i) const;
+    QSize imageSize(int i) const;
 
     void setModelToItemView(QAbstractItemView *view);
 
@@ -0,0 +1,591 @@
+#include <cstring>
+#include "JpegDecoder.hpp"
+
+#ifdef USE_LIBJPEG_TURBO
+#include <QThread>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QAtomicInt>
+#include <QSemaphore>
+#include <QVector>
+#include <cstdio>
+#include <csetjmp>
+#include <algorithm>
+#include <jpeglib.h>
+
+// これ以上の画素数ならリスタートマーカーで分割して並列にデコードする
+static const qint64 parallel_min_pixels = 16*1024*1024;
+
+struct jpeg_error
+{
+    struct jpeg_error_mgr pub;
+    jmp_buf jmp;
+};
+
+static void
+jpeg_error_exit(j_common_ptr cinfo)
+{
+    jpeg_error *err = reinterpret_cast<jpeg_error*>(cinfo->err);
+    longjmp(err->jmp, 1);
+}
+
+static void
+jpeg_output_message(j_common_ptr cinfo)
+{
+    Q_UNUSED(cinfo);
+}
+
+// cinfoを初期化してヘッダまで読む．失敗したらfalse
+static bool
+jpeg_begin(jpeg_decompress_struct &cinfo, const QByteArray &data)
+{
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo,
+            (unsigned char *)data.constData(), data.size());
+    return jpeg_read_header(&cinfo, TRUE) == JPEG_HEADER_OK;
+}
+
+// 先頭のskip行は捨て，続くcount行(負なら最後まで)をbufへ書き込む
+static bool
+jpeg_decode(const QByteArray &data, uchar *buf, int stride,
+        QImage::Format format, int options, int denom,
+        int skip = 0, int count = -1)
+{
+    J_COLOR_SPACE cs;
+    switch (format)
+    {
+        case QImage::Format_RGB32:
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+            cs = JCS_EXT_BGRX;
+#else
+            cs = JCS_EXT_XRGB;
+#endif
+            break;
+        case QImage::Format_Grayscale8:
+            cs = JCS_GRAYSCALE;
+            break;
+        default:
+            return false;
+    }
+
+    jpeg_decompress_struct cinfo;
+    jpeg_error err;
+    cinfo.err = jpeg_std_error(&err.pub);
+    err.pub.error_exit = jpeg_error_exit;
+    err.pub.output_message = jpeg_output_message;
+    if (setjmp(err.jmp))
+    {
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+
+    if (!jpeg_begin(cinfo, data) ||
+            cinfo.jpeg_color_space == JCS_CMYK ||
+            cinfo.jpeg_color_space == JCS_YCCK)
+    {
+        // CMYKはQtのプラグインに任せる
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+
+    cinfo.out_color_space = cs;
+    cinfo.dct_method = (options & JpegDecoder::FastIDCT)
+        ? JDCT_IFAST : JDCT_ISLOW;
+    cinfo.do_fancy_upsampling = (options & JpegDecoder::FastUpsampling)
+        ? FALSE : TRUE;
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = denom;
+
+    jpeg_start_decompress(&cinfo);
+    JSAMPROW rows[16];
+    if (skip > 0)
+    {
+        // 壊れたデータではlongjmpで抜けるので，デストラクタが要らない
+        // libjpegのプールから取る
+        JSAMPARRAY scratch = (*cinfo.mem->alloc_sarray)(
+                reinterpret_cast<j_common_ptr>(&cinfo), JPOOL_IMAGE,
+                cinfo.output_width * cinfo.output_components, 1);
+        rows[0] = scratch[0];
+        while (cinfo.output_scanline < JDIMENSION(skip))
+        {
+            jpeg_read_scanlines(&cinfo, rows, 1);
+        }
+    }
+    const JDIMENSION end = (count < 0) ? cinfo.output_height :
+        std::min<JDIMENSION>(cinfo.output_height, skip + count);
+    while (cinfo.output_scanline < end)
+    {
+        const JDIMENSION y = cinfo.output_scanline;
+        const int n = std::min<JDIMENSION>(16, end - y);
+        for (int i = 0; i < n; ++i)
+        {
+            rows[i] = buf + static_cast<qint64>(y - skip + i) * stride;
+        }
+        jpeg_read_scanlines(&cinfo, rows, n);
+    }
+    if (cinfo.output_scanline < cinfo.output_height)
+    {
+        jpeg_abort_decompress(&cinfo);
+    }
+    else
+    {
+        jpeg_finish_decompress(&cinfo);
+    }
+    jpeg_destroy_decompress(&cinfo);
+    return true;
+}
+
+/******************* restart marker *******************/
+// 並列デコードに必要なJPEGの構造
+struct jpeg_layout
+{
+    int sof_height_pos;     // SOFの高さフィールドの位置
+    int width;
+    int height;
+    int mcu_w;
+    int mcu_h;
+    int restart;            // リスタート間隔(MCU数)
+    qint64 scan_begin;      // エントロピー符号化データの先頭
+    qint64 scan_end;        // EOIの位置
+    QVector<qint64> rst;    // RSTマーカーの位置
+};
+
+static int
+be16(const uchar *p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+// 1スキャンのハフマン符号化でリスタート間隔があるものだけ受け付ける
+static bool
+jpeg_parse_layout(const QByteArray &data, jpeg_layout &l)
+{
+    const uchar *p = reinterpret_cast<const uchar*>(data.constData());
+    const qint64 len = data.size();
+    if (len < 4 || p[0] != 0xFF || p[1] != 0xD8) return false;
+
+    int ncomp = 0;
+    int hmax = 1;
+    int vmax = 1;
+    bool sof = false;
+    l.restart = 0;
+    l.scan_begin = 0;
+    l.scan_end = 0;
+    l.rst.clear();
+
+    qint64 pos = 2;
+    while (l.scan_begin == 0)
+    {
+        if (pos + 4 > len || p[pos] != 0xFF) return false;
+        const uchar m = p[pos+1];
+        if (m == 0xFF)
+        {
+            pos++;
+            continue;
+        }
+        const int seglen = be16(p+pos+2);
+        const uchar *s = p + pos + 4;
+        if (seglen < 2 || pos + 2 + seglen > len) return false;
+
+        switch (m)
+        {
+            case 0xC0: // ベースライン
+            case 0xC1: // 拡張シーケンシャル
+                if (seglen < 8) return false;
+                l.sof_height_pos = pos + 5;
+                l.height = be16(s+1);
+                l.width = be16(s+3);
+                ncomp = s[5];
+                if (seglen < 8 + 3*ncomp) return false;
+                for (int i = 0; i < ncomp; ++i)
+                {
+                    hmax = std::max(hmax, s[7+3*i] >> 4);
+                    vmax = std::max(vmax, s[7+3*i] & 0x0F);
+                }
+                sof = true;
+                break;
+            case 0xC2: case 0xC3: case 0xC5: case 0xC6: case 0xC7:
+            case 0xC9: case 0xCA: case 0xCB: case 0xCD: case 0xCE:
+            case 0xCF:
+                // プログレッシブ，ロスレス，算術符号化
+                return false;
+            case 0xDD:
+                if (seglen < 4) return false;
+                l.restart = be16(s);
+                break;
+            case 0xDA:
+                // 全成分をまとめた1つのスキャンであること
+                if (!sof || l.restart == 0 || l.width == 0 ||
+                        l.height == 0 || s[0] != ncomp)
+                {
+                    return false;
+                }
+                l.scan_begin = pos + 2 + seglen;
+                break;
+            case 0xD9:
+                return false;
+        }
+        pos += 2 + seglen;
+    }
+
+    if (ncomp == 1) hmax = vmax = 1;
+    l.mcu_w = 8 * hmax;
+    l.mcu_h = 8 * vmax;
+
+    for (pos = l.scan_begin; pos + 1 < len; )
+    {
+        const uchar *ff = static_cast<const uchar*>(
+                memchr(p + pos, 0xFF, len - pos - 1));
+        if (!ff) return false;
+        pos = ff - p;
+        const uchar m = p[pos+1];
+        if (m == 0xFF)
+        {
+            pos++;  // 詰め物
+        }
+        else if (m == 0x00)
+        {
+            pos += 2;
+        }
+        else if (0xD0 <= m && m <= 0xD7)
+        {
+            l.rst << pos;
+            pos += 2;
+        }
+        else if (m == 0xD9)
+        {
+            l.scan_end = pos;
+            break;
+        }
+        else
+        {
+            // DNLや2つ目のスキャンには対応しない
+            return false;
+        }
+    }
+    if (l.scan_end == 0) return false;
+
+    const qint64 mcus =
+        qint64((l.width + l.mcu_w - 1) / l.mcu_w) *
+        ((l.height + l.mcu_h - 1) / l.mcu_h);
+    return l.rst.size() + 1 == (mcus + l.restart - 1) / l.restart;
+}
+
+// リスタート区間[first, last)だけを含む高さheightのJPEGを作る
+static QByteArray
+jpeg_make_band(const QByteArray &data, const jpeg_layout &l,
+        int first, int last, int height)
+{
+    QByteArray band = data.left(l.scan_begin);
+    band[l.sof_height_pos]   = char(height >> 8);
+    band[l.sof_height_pos+1] = char(height & 0xFF);
+
+    const qint64 b = (first == 0) ? l.scan_begin : l.rst[first-1] + 2;
+    const qint64 e = (last-1 < l.rst.size()) ? l.rst[last-1] : l.scan_end;
+    const qint64 base = band.size() - b;
+    band.append(data.constData() + b, e - b);
+
+    // RSTマーカーは0から順に振り直す
+    for (int k = first; k < last-1; ++k)
+    {
+        band[base + l.rst[k] + 1] = char(0xD0 + ((k - first) & 7));
+    }
+    band.append("\xFF\xD9", 2);
+    return band;
+}
+
+class JpegBandTask : public QRunnable
+{
+public:
+    JpegBandTask(const QByteArray &band, uchar *buf, int stride,
+            QImage::Format format, int options, int skip, int count,
+            QAtomicInt *failed, QSemaphore *done)
+        : band(band), buf(buf), stride(stride), format(format)
+        , options(options), skip(skip), count(count), failed(failed)
+        , done(done)
+    {
+    }
+
+    void run()
+    {
+        if (!jpeg_decode(band, buf, stride, format, options, 1,
+                    skip, count))
+        {
+            failed->store(1);
+        }
+        done->release();
+    }
+
+private:
+    QByteArray band;
+    uchar *buf;
+    int stride;
+    QImage::Format format;
+    int options;
+    int skip;
+    int count;
+    QAtomicInt *failed;
+    QSemaphore *done;
+};
+
+// 帯のデコードに使うスレッド．大きなJPEGごとに作り直さないよう共有する
+static QThreadPool &
+band_pool()
+{
+    static QThreadPool pool;
+    return pool;
+}
+
+// MCU行の境界にあるリスタート区間で分け，帯ごとに別のスレッドで
+// 出力先の該当する行へデコードする．色差の補間が境界をまたいでも
+// 一括でデコードした結果と一致するよう，帯の上下に1区切り分
+// 余分にデコードして捨てる
+static bool
+jpeg_decode_parallel(const QByteArray &data, uchar *buf, int stride,
+        QImage::Format format, int options)
+{
+    const int nthreads = QThread::idealThreadCount();
+    jpeg_layout l;
+    if (nthreads < 2 || !jpeg_parse_layout(data, l)) return false;
+
+    const int mpr = (l.width + l.mcu_w - 1) / l.mcu_w;
+    const int rows = (l.height + l.mcu_h - 1) / l.mcu_h;
+    // MCU行の境界とリスタート区間の境界が一致する行の間隔
+    int step = l.restart;
+    for (int a = mpr % step; a != 0; )
+    {
+        const int t = step % a;
+        step = a;
+        a = t;
+    }
+    step = l.restart / step;
+    QVector<int> cuts;
+    cuts << 0;
+    for (int k = 1; k < nthreads; ++k)
+    {
+        int r = qint64(rows) * k / nthreads;
+        while (r < rows && (qint64(r) * mpr) % l.restart != 0) r++;
+        if (r < rows && r > cuts.last()) cuts << r;
+    }
+    cuts << rows;
+    if (cuts.size() < 3) return false;
+
+    QAtomicInt failed(0);
+    QSemaphore done;
+    for (int k = 0; k + 1 < cuts.size(); ++k)
+    {
+        // 書き込むのはMCU行[cuts[k], cuts[k+1])，デコードするのは[a, b)
+        const int a = std::max(0, cuts[k] - step);
+        const int b = (k + 2 == cuts.size()) ? rows
+            : std::min(rows, cuts[k+1] + step);
+        const int first = qint64(a) * mpr / l.restart;
+        const int last = (b == rows) ? l.rst.size() + 1
+            : qint64(b) * mpr / l.restart;
+        const int ya = a * l.mcu_h;
+        const int yb = (b == rows) ? l.height : b * l.mcu_h;
+        const int y0 = cuts[k] * l.mcu_h;
+        const int y1 = (k + 2 == cuts.size()) ? l.height
+            : cuts[k+1] * l.mcu_h;
+        band_pool().start(new JpegBandTask(
+                    jpeg_make_band(data, l, first, last, yb - ya),
+                    buf + qint64(y0) * stride, stride, format, options,
+                    y0 - ya, y1 - y0, &failed, &done));
+    }
+    // 共有しているので，待つのはここで入れたものだけにする
+    done.acquire(cuts.size() - 1);
+    return failed.load() == 0;
+}
+#endif
+
+static quint32
+exif_read(const uchar *p, int n, bool le)
+{
+    quint32 v = 0;
+    for (int i = 0; i < n; ++i)
+    {
+        v = (v << 8) | p[le ? n-1-i : i];
+    }
+    return v;
+}
+
+// TIFF形式のEXIFからIFD1のサムネイルを探す
+static bool
+exif_thumbnail(const uchar *t, qint64 len, QByteArray &thumb)
+{
+    if (len < 8) return false;
+    bool le;
+    if (t[0] == 'I' && t[1] == 'I')      le = true;
+    else if (t[0] == 'M' && t[1] == 'M') le = false;
+    else return false;
+
+    const qint64 ifd0 = exif_read(t+4, 4, le);
+    if (ifd0 + 2 > len) return false;
+    const qint64 next = ifd0 + 2 + 12 * exif_read(t+ifd0, 2, le);
+    if (next + 4 > len) return false;
+    const qint64 ifd1 = exif_read(t+next, 4, le);
+    if (ifd1 == 0 || ifd1 + 2 > len) return false;
+
+    const int n = exif_read(t+ifd1, 2, le);
+    qint64 offset = 0;
+    qint64 size = 0;
+    for (int i = 0; i < n; ++i)
+    {
+        const uchar *e = t + ifd1 + 2 + 12*i;
+        if (e + 12 > t + len) return false;
+        switch (exif_read(e, 2, le))
+        {
+            case 0x0201: offset = exif_read(e+8, 4, le); break;
+            case 0x0202: size   = exif_read(e+8, 4, le); break;
+        }
+    }
+    if (offset == 0 || size == 0 || offset + size > len) return false;
+    thumb = QByteArray(reinterpret_cast<const char*>(t + offset), size);
+    return true;
+}
+
+bool
+JpegDecoder::isAvailable()
+{
+#ifdef USE_LIBJPEG_TURBO
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool
+JpegDecoder::readHeader(const QByteArray &data, QSize &size,
+        bool &grayscale)
+{
+#ifdef USE_LIBJPEG_TURBO
+    jpeg_decompress_struct cinfo;
+    jpeg_error err;
+    cinfo.err = jpeg_std_error(&err.pub);
+    err.pub.error_exit = jpeg_error_exit;
+    err.pub.output_message = jpeg_output_message;
+    if (setjmp(err.jmp))
+    {
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+
+    bool ret = jpeg_begin(cinfo, data);
+    if (ret)
+    {
+        size = QSize(cinfo.image_width, cinfo.image_height);
+        grayscale = (cinfo.num_components == 1);
+    }
+    jpeg_destroy_decompress(&cinfo);
+    return ret;
+#else
+    Q_UNUSED(data);
+    Q_UNUSED(size);
+    Q_UNUSED(grayscale);
+    return false;
+#endif
+}
+
+bool
+JpegDecoder::decode(const QByteArray &data, uchar *buf, int stride,
+        QImage::Format format, int options)
+{
+#ifdef USE_LIBJPEG_TURBO
+    return jpeg_decode(data, buf, stride, format, options, 1);
+#else
+    Q_UNUSED(data);
+    Q_UNUSED(buf);
+    Q_UNUSED(stride);
+    Q_UNUSED(format);
+    Q_UNUSED(options);
+    return false;
+#endif
+}
+
+bool
+JpegDecoder::decode(const QByteArray &data, QImage &img,
+        QImage::Format format, int options)
+{
+    QSize size;
+    bool gray;
+    if (!readHeader(data, size, gray)) return false;
+
+    QImage out(size, format);
+    if (out.isNull()) return false;
+#ifdef USE_LIBJPEG_TURBO
+    if (qint64(size.width()) * size.height() >= parallel_min_pixels &&
+            jpeg_decode_parallel(data, out.bits(), out.bytesPerLine(),
+                format, options))
+    {
+        img = out;
+        return true;
+    }
+#endif
+    if (!decode(data, out.bits(), out.bytesPerLine(), format, options))
+    {
+        return false;
+    }
+    img = out;
+    return true;
+}
+
+bool
+JpegDecoder::decodeScaled(const QByteArray &data, QImage &img,
+        int denom, QImage::Format format, int options)
+{
+#ifdef USE_LIBJPEG_TURBO
+    QSize size;
+    bool gray;
+    if (!readHeader(data, size, gray)) return false;
+
+    // libjpegの出力は切り上げた大きさになる
+    QImage out((size.width() + denom-1) / denom,
+            (size.height() + denom-1) / denom, format);
+    if (out.isNull()) return false;
+    if (!jpeg_decode(data, out.bits(), out.bytesPerLine(), format,
+                options, denom))
+    {
+        return false;
+    }
+    img = out;
+    return true;
+#else
+    Q_UNUSED(data);
+    Q_UNUSED(img);
+    Q_UNUSED(denom);
+    Q_UNUSED(format);
+    Q_UNUSED(options);
+    return false;
+#endif
+}
+
+bool
+JpegDecoder::readExifThumbnail(const QByteArray &data, QByteArray &thumb)
+{
+    const uchar *p = reinterpret_cast<const uchar*>(data.constData());
+    const qint64 len = data.size();
+    if (len < 4 || p[0] != 0xFF || p[1] != 0xD8) return false;
+
+    qint64 pos = 2;
+    while (pos + 4 <= len)
+    {
+        if (p[pos] != 0xFF) return false;
+        const uchar marker = p[pos+1];
+        if (marker == 0xFF)
+        {
+            pos++;
+            continue;
+        }
+        // SOS以降にEXIFは無い
+        if (marker == 0xDA || marker == 0xD9) return false;
+
+        const qint64 seglen = (p[pos+2] << 8) | p[pos+3];
+        if (pos + 2 + seglen > len) return false;
+        if (marker == 0xE1 && seglen >= 8 &&
+                memcmp(p + pos + 4, "Exif\0\0", 6) == 0)
+        {
+            return exif_thumbnail(p + pos + 10, seglen - 8, thumb);
+        }
+        pos += 2 + seglen;
+    }
+    return false;
+}
@@ -0,0 +1,41 @@
+#ifndef JPEGDECODER_HPP
+#define JPEGDECODER_HPP
+
+#include <QByteArray>
+#include <QImage>
+#include <QSize>
+
+// libjpeg-turboで表示用のピクセル形式へ直接デコードする
+class JpegDecoder
+{
+public:
+    enum Option
+    {
+        Default        = 0,
+        FastIDCT       = 1 << 0, // 整数演算の高速IDCT(精度は落ちる)
+        FastUpsampling = 1 << 1, // 色差の補間を省略する
+    };
+
+    static bool isAvailable();
+
+    static bool readHeader(const QByteArray &data, QSize &size,
+            bool &grayscale);
+
+    // bufにはstride*height以上の領域を確保しておくこと．
+    // formatはFormat_RGB32かFormat_Grayscale8
+    static bool decode(const QByteArray &data, uchar *buf, int stride,
+            QImage::Format format, int options = Default);
+    static bool decode(const QByteArray &data, QImage &img,
+            QImage::Format format, int options = Default);
+    // DCTの段階で1/denom(2,4,8)に縮小してデコードする
+    static bool decodeScaled(const QByteArray &data, QImage &img,
+            int denom, QImage::Format format, int options = Default);
+
+    // EXIFに埋め込まれたサムネイル(JPEG)を取り出す
+    static bool readExifThumbnail(const QByteArray &data, QByteArray &thumb);
+
+private:
+    JpegDecoder() = delete;
+};
+
+#endif // JPEGDECODER_HPP
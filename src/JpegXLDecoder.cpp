@@ -0,0 +1,126 @@
+#include "JpegXLDecoder.hpp"
+
+#ifdef USE_LIBJXL
+#include <jxl/decode.h>
+#include <jxl/thread_parallel_runner.h>
+
+// outがnullならヘッダだけを読む
+static bool
+jxl_decode(const QByteArray &data, QSize &size, QImage *out)
+{
+    JxlDecoder *dec = JxlDecoderCreate(nullptr);
+    if (!dec) return false;
+
+    void *runner = nullptr;
+    int events = JXL_DEC_BASIC_INFO;
+    if (out)
+    {
+        runner = JxlThreadParallelRunnerCreate(nullptr,
+                JxlThreadParallelRunnerDefaultNumWorkerThreads());
+        if (runner)
+        {
+            JxlDecoderSetParallelRunner(dec, JxlThreadParallelRunner,
+                    runner);
+        }
+        events |= JXL_DEC_FULL_IMAGE;
+    }
+
+    JxlDecoderSubscribeEvents(dec, events);
+    JxlDecoderSetInput(dec,
+            reinterpret_cast<const uint8_t*>(data.constData()),
+            data.size());
+    JxlDecoderCloseInput(dec);
+
+    // QImage::Format_RGBA8888とバイト順が一致する
+    JxlPixelFormat format = {4, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0};
+    QImage img;
+    bool ret = false;
+    for (bool done = false; !done; )
+    {
+        switch (JxlDecoderProcessInput(dec))
+        {
+            case JXL_DEC_BASIC_INFO:
+            {
+                JxlBasicInfo info;
+                if (JxlDecoderGetBasicInfo(dec, &info) != JXL_DEC_SUCCESS)
+                {
+                    done = true;
+                    break;
+                }
+                size = QSize(info.xsize, info.ysize);
+                if (!out)
+                {
+                    ret = true;
+                    done = true;
+                }
+                break;
+            }
+            case JXL_DEC_NEED_IMAGE_OUT_BUFFER:
+            {
+                img = QImage(size, QImage::Format_RGBA8888);
+                format.align = img.bytesPerLine();
+                size_t len = 0;
+                if (img.isNull() ||
+                        JxlDecoderImageOutBufferSize(dec, &format, &len)
+                        != JXL_DEC_SUCCESS ||
+                        len > static_cast<size_t>(img.bytesPerLine())
+                        * img.height() ||
+                        JxlDecoderSetImageOutBuffer(dec, &format,
+                            img.bits(), len) != JXL_DEC_SUCCESS)
+                {
+                    done = true;
+                }
+                break;
+            }
+            case JXL_DEC_FULL_IMAGE:
+                *out = img;
+                ret = true;
+                done = true;
+                break;
+            default:
+                // エラー，入力不足または完了
+                done = true;
+                break;
+        }
+    }
+
+    if (runner) JxlThreadParallelRunnerDestroy(runner);
+    JxlDecoderDestroy(dec);
+    return ret;
+}
+#endif
+
+bool
+JpegXLDecoder::isAvailable()
+{
+#ifdef USE_LIBJXL
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool
+JpegXLDecoder::readHeader(const QByteArray &data, QSize &size)
+{
+#ifdef USE_LIBJXL
+    return jxl_decode(data, size, nullptr);
+#else
+    Q_UNUSED(data);
+    Q_UNUSED(size);
+    return false;
+#endif
+}
+
+bool
+JpegXLDecoder::decode(const QByteArray &data, QImage &img)
+{
+#ifdef USE_LIBJXL
+    QSize size;
+    return jxl_decode(data, size, &img);
+#else
+    Q_UNUSED(data);
+    Q_UNUSED(img);
+    return false;
+#endif
+}
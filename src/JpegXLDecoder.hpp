@@ -0,0 +1,21 @@
+#ifndef JPEGXLDECODER_HPP
+#define JPEGXLDECODER_HPP
+
+#include <QByteArray>
+#include <QImage>
+#include <QSize>
+
+// libjxlでデコードする(アニメーションは最初のフレームのみ)
+class JpegXLDecoder
+{
+public:
+    static bool isAvailable();
+
+    static bool readHeader(const QByteArray &data, QSize &size);
+    static bool decode(const QByteArray &data, QImage &img);
+
+private:
+    JpegXLDecoder() = delete;
+};
+
+#endif // JPEGXLDECODER_HPP
@@ -73,9 +73,13 @@ MainWindow::menu_file_settings_triggered()
     if (SettingDialog::openSettingDialog())
     {
         viewer->setOpenDirLevel(App::view_openlevel);
+        viewer->setOpenDirThreads(App::view_openthreads);
+        viewer->setWatchDirs(App::view_watchdirs);
         viewer->setCacheSize(App::pl_prefetch);
+        viewer->setPackedCacheSize(App::pl_packedcache);
         viewer->setFeedPageMode(
                 static_cast<Viewer::FeedPageMode>(App::view_feedpage));
+        viewer->setFastDecode(App::view_fastdecode);
     }
 }
 
@@ -102,7 +106,13 @@ void
 MainWindow::menu_view_setscale_triggered()
 {
     double ret;
-    if (ScaleDialog::getScale(viewer->getImageSize(),
+    QSize size = viewer->getImageSize();
+    if (size.isEmpty() && !viewer->empty())
+    {
+        // まだデコードされていなければヘッダから得た寸法を使う
+        size = viewer->imageSize(viewer->currentIndex(0));
+    }
+    if (ScaleDialog::getScale(size,
                 viewer->getCustomScaleFactor(), ret))
     {
         changeCheckedScaleMenu(menu_view_setscale,
@@ -132,6 +142,12 @@ MainWindow::menu_view_rightbinding_triggered()
     viewer->setRightbindingView(menu_view_rightbinding->isChecked());
 }
 
+void
+MainWindow::menu_view_splitwide_triggered()
+{
+    viewer->setSplitWidePages(menu_view_splitwide->isChecked());
+}
+
 void
 MainWindow::menu_view_nn_triggered()
 {
@@ -309,6 +325,8 @@ MainWindow::createMenus()
     menu_view_autospread->setCheckable(true);
     menu_view_rightbinding = new QAction(tr("Right Binding"), this);
     menu_view_rightbinding->setCheckable(true);
+    menu_view_splitwide    = new QAction(tr("Split Wide Pages"), this);
+    menu_view_splitwide->setCheckable(true);
     menu_view_nn           = new QAction(tr("Low (Nearest Neighbor)"), this);
     menu_view_nn->setCheckable(true);
     menu_view_bi           = new QAction(tr("Balance (Bilinear)"), this);
@@ -324,6 +342,7 @@ MainWindow::createMenus()
     menu_view->addAction(menu_view_spread);
     menu_view->addAction(menu_view_autospread);
     menu_view->addAction(menu_view_rightbinding);
+    menu_view->addAction(menu_view_splitwide);
     menu_view->addSeparator();
     menu_view->addAction(menu_view_nn);
     menu_view->addAction(menu_view_bi);
@@ -342,6 +361,8 @@ MainWindow::createMenus()
             this, SLOT(menu_view_autospread_triggered()));
     connect(menu_view_rightbinding, SIGNAL(triggered()),
             this, SLOT(menu_view_rightbinding_triggered()));
+    connect(menu_view_splitwide,    SIGNAL(triggered()),
+            this, SLOT(menu_view_splitwide_triggered()));
     connect(menu_view_nn,           SIGNAL(triggered()),
             this, SLOT(menu_view_nn_triggered()));
     connect(menu_view_bi,           SIGNAL(triggered()),
@@ -426,15 +447,23 @@ MainWindow::applySettings()
 
     viewer->setRightbindingView(App::view_rbind);
     menu_view_rightbinding->setChecked(App::view_rbind);
+
+    viewer->setSplitWidePages(App::view_splitwide);
+    menu_view_splitwide->setChecked(App::view_splitwide);
     
     viewer->setFeedPageMode(
             static_cast<Viewer::FeedPageMode>(App::view_feedpage));
 
     viewer->setOpenDirLevel(App::view_openlevel);
+    viewer->setOpenDirThreads(App::view_openthreads);
+    viewer->setWatchDirs(App::view_watchdirs);
+
+    viewer->setFastDecode(App::view_fastdecode);
 
     dockwidget->setVisible(App::pl_visible);
 
     viewer->setCacheSize(App::pl_prefetch);
+    viewer->setPackedCacheSize(App::pl_packedcache);
 }
 
 void
@@ -449,9 +478,13 @@ MainWindow::storeSettings()
     App::view_spread     = menu_view_spread->isChecked();
     App::view_autospread = menu_view_autospread->isChecked();
     App::view_rbind      = menu_view_rightbinding->isChecked();
+    App::view_splitwide  = menu_view_splitwide->isChecked();
     App::view_openlevel  = viewer->getOpenDirLevel();
+    App::view_openthreads = viewer->getOpenDirThreads();
+    App::view_watchdirs  = viewer->getWatchDirs();
     App::view_feedpage   =
         static_cast<Viewer::FeedPageMode>(viewer->getFeedPageMode());
+    App::view_fastdecode = viewer->getFastDecode();
 
     App::pl_visible  = dockwidget->isVisible();
     App::pl_prefetch = viewer->getCacheSize();
@@ -33,6 +33,7 @@ private slots:
     void menu_view_spread_triggered();
     void menu_view_autospread_triggered();
     void menu_view_rightbinding_triggered();
+    void menu_view_splitwide_triggered();
     void menu_view_nn_triggered();
     void menu_view_bi_triggered();
     void menu_view_bc_triggered();
@@ -68,6 +69,7 @@ private:
     QAction *menu_view_spread;
     QAction *menu_view_autospread;
     QAction *menu_view_rightbinding;
+    QAction *menu_view_splitwide;
     QAction *menu_view_nn;
     QAction *menu_view_bi;
     QAction *menu_view_bc;
@@ -0,0 +1,172 @@
+#include <algorithm>
+#include "PackedImage.hpp"
+
+#ifdef USE_LZ4
+#include <QThreadPool>
+#include <QRunnable>
+#include <QAtomicInt>
+#include <QSemaphore>
+#include <cstring>
+#include <lz4.h>
+
+// 展開に使うスレッド．呼ぶたびに作ると開始と終了の分だけ遅くなる
+static QThreadPool &
+unpack_pool()
+{
+    static QThreadPool pool;
+    return pool;
+}
+
+class UnpackTask : public QRunnable
+{
+public:
+    UnpackTask(const QVector<QByteArray> &bands, int first, int last,
+            int band_rows, int bpl, uchar *bits, int stride, int height,
+            QAtomicInt *failed, QSemaphore *done)
+        : bands(bands), first(first), last(last), band_rows(band_rows)
+        , bpl(bpl), bits(bits), stride(stride), height(height)
+        , failed(failed), done(done)
+    {
+    }
+
+    void run()
+    {
+        unpack();
+        done->release();
+    }
+
+private:
+    const QVector<QByteArray> &bands;
+    int first;
+    int last;
+    int band_rows;
+    int bpl;
+    uchar *bits;
+    int stride;
+    int height;
+    QAtomicInt *failed;
+    QSemaphore *done;
+
+    void unpack()
+    {
+        QByteArray buf(band_rows * bpl, Qt::Uninitialized);
+        for (int b = first; b < last; ++b)
+        {
+            const int y0 = b * band_rows;
+            const int rows = std::min(band_rows, height - y0);
+            const int len = rows * bpl;
+            if (LZ4_decompress_safe(bands[b].constData(), buf.data(),
+                        bands[b].size(), len) != len)
+            {
+                failed->store(1);
+                return;
+            }
+            // QImageの行は4バイト境界に揃えられているので1行ずつ写す
+            for (int y = 0; y < rows; ++y)
+            {
+                std::memcpy(bits + qint64(y0 + y) * stride,
+                        buf.constData() + y * bpl, bpl);
+            }
+        }
+    }
+};
+#endif
+
+PackedImage::PackedImage(const QImage &img)
+    : size()
+    , format(QImage::Format_Invalid)
+    , bpl(0)
+    , bands()
+{
+#ifdef USE_LZ4
+    if (img.isNull()) return;
+
+    const int b = (img.width() * img.depth() + 7) / 8;
+    const int n = (img.height() + band_rows - 1) / band_rows;
+    QByteArray raw(band_rows * b, Qt::Uninitialized);
+    QVector<QByteArray> packed(n);
+    for (int i = 0; i < n; ++i)
+    {
+        const int y0 = i * band_rows;
+        const int rows = std::min(band_rows, img.height() - y0);
+        for (int y = 0; y < rows; ++y)
+        {
+            std::memcpy(raw.data() + y * b, img.constScanLine(y0 + y), b);
+        }
+        const int len = rows * b;
+        QByteArray &dst = packed[i];
+        dst.resize(LZ4_compressBound(len));
+        const int r = LZ4_compress_default(raw.constData(), dst.data(),
+                len, dst.size());
+        if (r <= 0) return;
+        dst.resize(r);
+        dst.squeeze();
+    }
+
+    size = img.size();
+    format = img.format();
+    bpl = b;
+    bands = packed;
+#else
+    Q_UNUSED(img);
+#endif
+}
+
+bool
+PackedImage::isAvailable()
+{
+#ifdef USE_LZ4
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool
+PackedImage::isNull() const
+{
+    return bands.isEmpty();
+}
+
+int
+PackedImage::cost() const
+{
+    qint64 bytes = 0;
+    for (auto iter = bands.cbegin(); iter != bands.cend(); ++iter)
+    {
+        bytes += iter->size();
+    }
+    return std::max<qint64>(1, bytes / 1024);
+}
+
+QImage
+PackedImage::unpack() const
+{
+#ifdef USE_LZ4
+    if (isNull()) return QImage();
+
+    QImage img(size, format);
+    if (img.isNull()) return QImage();
+
+    // 帯をスレッドの数で分けて並行に展開する
+    const int n = bands.size();
+    QThreadPool &pool = unpack_pool();
+    const int threads = std::max(1, std::min(n, pool.maxThreadCount()));
+    uchar *bits = img.bits();
+    QAtomicInt failed(0);
+    QSemaphore done;
+    for (int t = 0; t < threads; ++t)
+    {
+        pool.start(new UnpackTask(bands, n * t / threads,
+                    n * (t + 1) / threads, band_rows, bpl,
+                    bits, img.bytesPerLine(), img.height(), &failed,
+                    &done));
+    }
+    // 共有しているので，待つのはここで入れたものだけにする
+    done.acquire(threads);
+    if (failed.load() != 0) return QImage();
+    return img;
+#else
+    return QImage();
+#endif
+}
@@ -0,0 +1,34 @@
+#ifndef PACKEDIMAGE_HPP
+#define PACKEDIMAGE_HPP
+
+#include <QVector>
+#include <QByteArray>
+#include <QImage>
+#include <QSize>
+
+// デコード済みの画像を数十行ずつの帯に分けてLZ4で圧縮して持つ．
+// 帯ごとに独立して圧縮するので展開は複数のスレッドで並行して行い，
+// 展開先のQImageの各行へ直接書き込む
+class PackedImage
+{
+public:
+    explicit PackedImage(const QImage &img);
+
+    static bool isAvailable();
+
+    bool isNull() const;
+    // 圧縮後の大きさ(KiB)
+    int cost() const;
+    QImage unpack() const;
+
+private:
+    QSize size;
+    QImage::Format format;
+    int bpl;                    // 1行のバイト数(パディングは含まない)
+    QVector<QByteArray> bands;
+
+    // 1つの帯にする行数
+    static const int band_rows = 64;
+};
+
+#endif // PACKEDIMAGE_HPP
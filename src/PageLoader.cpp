@@ -0,0 +1,283 @@
+#include <QElapsedTimer>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QSemaphore>
+#include <limits>
+#include "PageLoader.hpp"
+#include "StreamDevice.hpp"
+#include "ProgressiveDecoder.hpp"
+#include "Decoder.hpp"
+#include "JpegDecoder.hpp"
+#include "AnimationDecoder.hpp"
+#include "TiffPages.hpp"
+
+// 展開中のデバイスから届いた分ずつデコードする
+class StreamDecodeTask : public QRunnable
+{
+public:
+    StreamDecodeTask(QIODevice *device, const QByteArray &format,
+            QImage *img)
+        : device(device), format(format), img(img)
+    {
+        setAutoDelete(false);
+    }
+
+    void run()
+    {
+        Decoder::decode(device, format, *img);
+        done.release();
+    }
+
+    void wait()
+    {
+        done.acquire();
+    }
+
+private:
+    QIODevice *device;
+    QByteArray format;
+    QImage *img;
+    QSemaphore done;
+};
+
+PageLoader::PageLoader(QObject *parent)
+    : QThread(parent)
+    , reqs()
+    , cur_gen(0)
+    , quit(false)
+{
+    start();
+}
+
+PageLoader::~PageLoader()
+{
+    mutex.lock();
+    quit = true;
+    reqs.clear();
+    cur_gen.fetchAndAddOrdered(1);
+    cond_req.wakeOne();
+    mutex.unlock();
+    wait();
+}
+
+void
+PageLoader::putRequest(int gen, int slot, const ImageFile &f, int options)
+{
+    Request req;
+    req.gen = gen;
+    req.slot = slot;
+    req.file = f;
+    req.options = options;
+
+    mutex.lock();
+    reqs << req;
+    cond_req.wakeOne();
+    mutex.unlock();
+}
+
+void
+PageLoader::cancel(int gen)
+{
+    mutex.lock();
+    cur_gen.store(gen);
+    reqs.clear();
+    mutex.unlock();
+}
+
+QImage
+PageLoader::makePlaceholder(const QImage &img, const QSize &size)
+{
+    if (img.isNull() || size.isEmpty()) return QImage();
+
+    // 縦横比が違っても元の画像の位置にそのまま引き伸ばされるようにする
+    QImage ph = Decoder::toDisplayFormat(img);
+    const int h = std::max(1, qRound(ph.width() *
+                size.height() / static_cast<double>(size.width())));
+    if (ph.height() != h)
+    {
+        ph = ph.scaled(ph.width(), h, Qt::IgnoreAspectRatio,
+                Qt::FastTransformation);
+    }
+    ph.setDevicePixelRatio(ph.width() / static_cast<double>(size.width()));
+    return ph;
+}
+
+void
+PageLoader::run()
+{
+    for (;;)
+    {
+        mutex.lock();
+        while (reqs.empty() && !quit)
+        {
+            cond_req.wait(&mutex);
+        }
+        if (quit)
+        {
+            mutex.unlock();
+            return;
+        }
+        Request req = reqs.takeFirst();
+        mutex.unlock();
+
+        if (!isCanceled(req.gen)) load(req);
+    }
+}
+
+bool
+PageLoader::isCanceled(int gen) const
+{
+    return cur_gen.load() != gen;
+}
+
+void
+PageLoader::load(const Request &req)
+{
+    if (req.file.fileType() == ImageFile::PAGE)
+    {
+        // IFDの位置から直接そのページだけを読む
+        QImage img;
+        TiffPages::decode(req.file.physicalFilePath(),
+                req.file.pageOffset(), img);
+        if (isCanceled(req.gen)) return;
+        emit loaded(req.gen, req.slot, Decoder::toDisplayFormat(img), false);
+        return;
+    }
+
+    ProgressiveDecoder pd(req.file.format(), req.options);
+    const bool progressive = pd.isSupported();
+    const qint64 size = req.file.dataSize();
+    if (!progressive && Decoder::canStream(req.file.format()) &&
+            0 < size && size <= std::numeric_limits<int>::max())
+    {
+        loadStream(req, size);
+        return;
+    }
+
+    QByteArray data;
+    if (0 < size && size <= std::numeric_limits<int>::max())
+    {
+        data.reserve(size);
+    }
+    const bool jpeg = (req.file.format() == "jpeg");
+    bool thumb_done = !jpeg;
+    bool shown = false;     // 仮の画像を送ったか
+    QElapsedTimer timer;
+    timer.start();
+    qint64 last = 0;
+
+    bool ok = req.file.readData([&](const char *buf, qint64 len)
+    {
+        if (isCanceled(req.gen)) return false;
+        data.append(buf, len);
+
+        if (!thumb_done)
+        {
+            shown = sendThumbnail(req, data);
+            thumb_done = shown || data.size() >= thumbnail_search_size;
+        }
+
+        // すぐに読み終わる画像では途中経過を作らない
+        if (progressive &&
+                timer.elapsed() - last >= progressive_interval)
+        {
+            QImage img;
+            if (pd.update(data, img))
+            {
+                emit loaded(req.gen, req.slot, img, true);
+                shown = true;
+            }
+            last = timer.elapsed();
+        }
+        return true;
+    });
+    if (isCanceled(req.gen)) return;
+
+    QImage img;
+    if (ok && !data.isEmpty())
+    {
+        // 全体のデコードは時間が掛かるので先に縮小したものを見せる
+        if (jpeg && !shown) sendScaled(req, data);
+        if (isCanceled(req.gen)) return;
+        Decoder::decode(data, req.file.format(), img, req.options);
+    }
+    emit loaded(req.gen, req.slot, Decoder::toDisplayFormat(img), false);
+    if (!img.isNull() &&
+            AnimationDecoder::isAnimated(data, req.file.format()))
+    {
+        emit animated(req.gen, req.slot, data);
+    }
+}
+
+void
+PageLoader::loadStream(const Request &req, qint64 size)
+{
+    StreamDevice dev(size);
+    dev.open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+    QImage img;
+    StreamDecodeTask task(&dev, req.file.format(), &img);
+    QThreadPool::globalInstance()->start(&task);
+
+    req.file.readData([&](const char *buf, qint64 len)
+    {
+        if (isCanceled(req.gen)) return false;
+        dev.append(buf, len);
+        return true;
+    });
+    // 途中で止めたときは届かなかった分を読めずにデコードが終わる
+    dev.finish();
+    task.wait();
+    if (isCanceled(req.gen)) return;
+
+    // 判定を誤っていたときは全体を読んでからデコードし直す
+    const QByteArray data = dev.data();
+    if (img.isNull() && data.size() == size)
+    {
+        Decoder::decode(data, req.file.format(), img, req.options);
+    }
+    emit loaded(req.gen, req.slot, Decoder::toDisplayFormat(img), false);
+    if (!img.isNull() &&
+            AnimationDecoder::isAnimated(data, req.file.format()))
+    {
+        emit animated(req.gen, req.slot, data);
+    }
+}
+
+bool
+PageLoader::sendThumbnail(const Request &req, const QByteArray &data)
+{
+    QSize size;
+    QByteArray thumb;
+    if (!Decoder::probe(data, req.file.format(), size) ||
+            !JpegDecoder::readExifThumbnail(data, thumb))
+    {
+        return false;
+    }
+
+    QImage img;
+    if (!Decoder::decode(thumb, "jpeg", img)) return false;
+    emit loaded(req.gen, req.slot, makePlaceholder(img, size), true);
+    return true;
+}
+
+bool
+PageLoader::sendScaled(const Request &req, const QByteArray &data)
+{
+    QSize size;
+    if (!Decoder::probe(data, req.file.format(), size) ||
+            static_cast<qint64>(size.width()) * size.height()
+            < placeholder_min_pixels)
+    {
+        return false;
+    }
+
+    QImage img;
+    const QSize small((size.width() + 7) / 8, (size.height() + 7) / 8);
+    if (!Decoder::decodeScaled(data, req.file.format(), small, img,
+                req.options))
+    {
+        return false;
+    }
+    emit loaded(req.gen, req.slot, makePlaceholder(img, size), true);
+    return true;
+}
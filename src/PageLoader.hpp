@@ -0,0 +1,68 @@
+#ifndef PAGELOADER_HPP
+#define PAGELOADER_HPP
+
+#include <QThread>
+#include <QVector>
+#include <QImage>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QAtomicInt>
+#include "ImageFile.hpp"
+
+// キャッシュに無いページを読み込んでデコードする．
+// 先にEXIFサムネイルや1/8の縮小デコードを仮の画像として送り，
+// 読み込みに時間が掛かる場合は届いた分で途中経過の画像を送る．
+// QImageReaderで読むフォーマットは展開と並行してデコードする
+class PageLoader : public QThread
+{
+    Q_OBJECT
+public:
+    explicit PageLoader(QObject *parent = 0);
+    ~PageLoader();
+
+    // genが変わると古い要求は破棄される
+    void putRequest(int gen, int slot, const ImageFile &f, int options);
+    void cancel(int gen);
+
+    // 小さな画像をsizeの大きさで表示させるための仮の画像にする
+    static QImage makePlaceholder(const QImage &img, const QSize &size);
+
+signals:
+    // partialがtrueなら途中経過の画像
+    void loaded(int gen, int slot, const QImage &img, bool partial);
+    // アニメーション画像だったときはloadedの後に送る
+    void animated(int gen, int slot, const QByteArray &data);
+
+protected:
+    void run();
+
+private:
+    struct Request
+    {
+        int gen;
+        int slot;
+        ImageFile file;
+        int options;
+    };
+
+    QVector<Request> reqs;
+    QMutex mutex;
+    QWaitCondition cond_req;
+    QAtomicInt cur_gen;
+    bool quit;
+
+    // 途中経過をデコードし直す間隔(ms)
+    static const int progressive_interval = 150;
+    // EXIFサムネイルを探すのは先頭のこのバイト数まで
+    static const int thumbnail_search_size = 256*1024;
+    // これより画素数の少ない画像は縮小デコードを挟まない
+    static const int placeholder_min_pixels = 2*1024*1024;
+
+    bool isCanceled(int gen) const;
+    void load(const Request &req);
+    void loadStream(const Request &req, qint64 size);
+    bool sendThumbnail(const Request &req, const QByteArray &data);
+    bool sendScaled(const Request &req, const QByteArray &data);
+};
+
+#endif // PAGELOADER_HPP
@@ -1,9 +1,83 @@
-#include "PlaylistModel.hpp"
 #include <QFileInfo>
-#include <QDir>
+#include <QDirIterator>
+#include <algorithm>
+#include "PlaylistModel.hpp"
+#include "JpegDecoder.hpp"
+#include "Decoder.hpp"
+#include "AnimationDecoder.hpp"
 
 #include "for_windows_env.hpp"
 
+static void
+release_view(void *info)
+{
+    delete static_cast<QImage*>(info);
+}
+
+// pathそのものか，pathsのどれかのディレクトリの下にあるか
+static bool
+isUnder(const QString &path, const QSet<QString> &paths)
+{
+    QString p = path;
+    while (!p.isEmpty())
+    {
+        if (paths.contains(p)) return true;
+        p.truncate(std::max(0, p.lastIndexOf('/')));
+    }
+    return false;
+}
+
+// ディレクトリをたどったときの順に比べる．行ごとに呼ばれるので
+// 区切りごとに分けたリストは作らずにその場で比べる
+static bool
+pathLess(const QString &a, const QString &b)
+{
+    int i = 0;
+    int j = 0;
+    for (;;)
+    {
+        const int x = a.indexOf('/', i);
+        const int y = b.indexOf('/', j);
+        const int c = a.midRef(i, x < 0 ? -1 : x - i).compare(
+                b.midRef(j, y < 0 ? -1 : y - j), Qt::CaseInsensitive);
+        if (c != 0) return c < 0;
+        if (x < 0 || y < 0) return x < 0 && y >= 0;
+        i = x + 1;
+        j = y + 1;
+    }
+}
+
+// 左右に分ける横長のページか
+static bool
+isWideSize(const QSize &size)
+{
+    return size.width() > size.height();
+}
+
+static QString
+parentDir(const QString &path)
+{
+    return path.left(std::max(0, path.lastIndexOf('/')));
+}
+
+// 見開きの画像の片側を，画素をコピーせずに元の画像と共有して取り出す
+static QImage
+halfView(const QImage &img, ImageFile::Half half)
+{
+    if (half == ImageFile::WHOLE || img.width() < 2) return img;
+
+    const int lw = img.width() / 2;
+    const int x = (half == ImageFile::LEFT) ? 0 : lw;
+    const int w = (half == ImageFile::LEFT) ? lw : img.width() - lw;
+    // 元の画像はviewが破棄されるまで持っておく
+    QImage *owner = new QImage(img);
+    QImage view(owner->constBits() + x * (owner->depth() / 8),
+            w, owner->height(), owner->bytesPerLine(), owner->format(),
+            release_view, owner);
+    view.setDevicePixelRatio(img.devicePixelRatio());
+    return view;
+}
+
 PlaylistModel::PlaylistModel(QObject *parent)
     : QAbstractListModel(parent)
     , slct(new QItemSelectionModel(this))
@@ -11,8 +85,47 @@ PlaylistModel::PlaylistModel(QObject *parent)
     , opendirlevel(1)
     , img_index(-1)
     , img_num(0)
+    , jpeg_opts(JpegDecoder::Default)
+    , split_wide(false)
+    , rbind(false)
+    , probe_row(0)
     , prft()
+    , prober()
+    , pageinfo()
+    , loader()
+    , lister()
+    , unindexed()
+    , load_gen(0)
+    , page_files()
+    , page_shared(false)
+    , page_shown(false)
+    , watch_dirs(false)
+    , watcher()
+    , watched()
+    , watched_files()
+    , changed_dirs()
+    , changed_files()
+    , watch_timer()
+    , settle_timer()
 {
+    page_ready[0] = page_ready[1] = false;
+    connect(&prober, SIGNAL(probed(const QString &, const QSize &,
+                    const QByteArray &, qint64)),
+            this, SLOT(imageProbed(const QString &, const QSize &,
+                    const QByteArray &, qint64)));
+    connect(&loader, SIGNAL(loaded(int, int, const QImage &, bool)),
+            this, SLOT(pageLoaded(int, int, const QImage &, bool)));
+    connect(&loader, SIGNAL(animated(int, int, const QByteArray &)),
+            this, SLOT(pageAnimated(int, int, const QByteArray &)));
+    connect(&lister, SIGNAL(listed()), this, SLOT(filesListed()));
+    connect(&watcher, SIGNAL(directoryChanged(const QString &)),
+            this, SLOT(directoryChanged(const QString &)));
+    connect(&watcher, SIGNAL(fileChanged(const QString &)),
+            this, SLOT(fileChanged(const QString &)));
+    watch_timer.setSingleShot(true);
+    connect(&watch_timer, SIGNAL(timeout()), this, SLOT(applyChanges()));
+    settle_timer.setSingleShot(true);
+    connect(&settle_timer, SIGNAL(timeout()), this, SLOT(settleFiles()));
 }
 
 PlaylistModel::~PlaylistModel()
@@ -36,7 +149,21 @@ PlaylistModel::data(const QModelIndex &idx, int role) const
         case Qt::DisplayRole:
             return files[row]->logicalFileName();
         case Qt::ToolTipRole:
-            return files[row]->physicalFilePath();
+        {
+            const QString path = files[row]->physicalFilePath();
+            auto iter = pageinfo.constFind(files[row]->createKey());
+            if (iter == pageinfo.constEnd()) return path;
+            QString tip = QString("%1\n%2x%3 %4")
+                .arg(path)
+                .arg(iter->size.width())
+                .arg(iter->size.height())
+                .arg(QString(iter->format));
+            if (iter->bytes > 0)
+            {
+                tip += QString(" (%1 KiB)").arg(iter->bytes / 1024);
+            }
+            return tip;
+        }
         case Qt::BackgroundRole:
             if (isCurrentIndex(row))
             {
@@ -72,18 +199,30 @@ PlaylistModel::removeSelectedItem()
     QModelIndexList list = slct->selectedRows();
     if (list.empty()) return;
 
-    int c = 0;
     for (auto iter = list.cbegin();
             iter != list.cend(); ++iter)
     {
         int row = (*iter).row();
-        if (row < img_index) c++;
+        forgetUnindexed(files[row]);
         delete files[row];
         files[row] = nullptr;
     }
+    removeNullFiles();
+}
+
+// nullptrにした行を取り除いて表示しているページを合わせる
+void
+PlaylistModel::removeNullFiles()
+{
+    int c = 0;
+    for (int i = 0; i < img_index; ++i)
+    {
+        if (files[i] == nullptr) c++;
+    }
 
-    bool contain = (files[currentIndex(0)] == nullptr ||
-        (countShowImages() > 1 && files[currentIndex(1)] == nullptr));
+    bool contain = isValidIndex(img_index) &&
+        (files[currentIndex(0)] == nullptr ||
+         (countShowImages() > 1 && files[currentIndex(1)] == nullptr));
 
     for (int i = 0; i < files.count(); )
     {
@@ -112,6 +251,25 @@ PlaylistModel::removeSelectedItem()
     emit changePlaylistStatus();
 }
 
+// 索引を待っている書庫のページなら覚えておく
+void
+PlaylistModel::trackUnindexed(ImageFile *f)
+{
+    if (f->fileType() != ImageFile::ARCHIVE || f->archiveIndex()) return;
+    unindexed[f->physicalFilePath()] << f;
+}
+
+// 取り除くページを索引を待っているページから外す
+void
+PlaylistModel::forgetUnindexed(ImageFile *f)
+{
+    if (f->fileType() != ImageFile::ARCHIVE || f->archiveIndex()) return;
+    auto iter = unindexed.find(f->physicalFilePath());
+    if (iter == unindexed.end()) return;
+    iter->removeOne(f);
+    if (iter->empty()) unindexed.erase(iter);
+}
+
 void
 PlaylistModel::clearPlaylist()
 {
@@ -123,6 +281,13 @@ PlaylistModel::clearPlaylist()
         files.clear();
     }
     endRemoveRows();
+    unindexed.clear();
+    lister.clear();
+    prober.clear();
+    pageinfo.clear();
+    probe_row = 0;
+
+    unwatchAll();
 
     img_index = -1;
     img_num = 0;
@@ -142,6 +307,31 @@ PlaylistModel::getOpenDirLevel() const
     return opendirlevel;
 }
 
+void
+PlaylistModel::setOpenDirThreads(int n)
+{
+    lister.setScanThreads(n);
+}
+
+int
+PlaylistModel::getOpenDirThreads() const
+{
+    return lister.getScanThreads();
+}
+
+void
+PlaylistModel::setWatchDirs(bool watch)
+{
+    watch_dirs = watch;
+    if (!watch) unwatchAll();
+}
+
+bool
+PlaylistModel::getWatchDirs() const
+{
+    return watch_dirs;
+}
+
 void
 PlaylistModel::setCacheSize(int n)
 {
@@ -154,6 +344,60 @@ PlaylistModel::getCacheSize() const
     return prft.getCacheSize();
 }
 
+void
+PlaylistModel::setPackedCacheSize(int mib)
+{
+    prft.setPackedCacheSize(mib);
+}
+
+int
+PlaylistModel::getPackedCacheSize() const
+{
+    return prft.getPackedCacheSize();
+}
+
+void
+PlaylistModel::setFastDecode(bool fast)
+{
+    jpeg_opts = fast ? (JpegDecoder::FastIDCT | JpegDecoder::FastUpsampling)
+                     : JpegDecoder::Default;
+    prft.setDecodeOptions(jpeg_opts);
+}
+
+bool
+PlaylistModel::getFastDecode() const
+{
+    return jpeg_opts != JpegDecoder::Default;
+}
+
+void
+PlaylistModel::setSplitWidePages(bool split)
+{
+    if (split_wide == split) return;
+    split_wide = split;
+    if (empty()) return;
+
+    for (int row = 0; row < count(); ++row)
+    {
+        if (!split)
+        {
+            if (files[row]->half() != ImageFile::WHOLE) mergePage(row);
+        }
+        else if (isWidePage(*files[row]))
+        {
+            splitPage(row++);
+        }
+    }
+    showImages();
+    emit changePlaylistStatus();
+}
+
+bool
+PlaylistModel::getSplitWidePages() const
+{
+    return split_wide;
+}
+
 int
 PlaylistModel::countShowImages() const
 {
@@ -193,6 +437,32 @@ PlaylistModel::currentFileName(int i) const
     return QString();
 }
 
+QSize
+PlaylistModel::imageSize(int i) const
+{
+    if (!isValidIndex(i)) return QSize();
+    return pageSize(*files[i]);
+}
+
+QSize
+PlaylistModel::pageSize(const ImageFile &f) const
+{
+    // 分割したページは片側の大きさ
+    QSize size = pageinfo.value(f.createKey()).size;
+    switch (f.half())
+    {
+        case ImageFile::LEFT:
+            size.setWidth(size.width() / 2);
+            break;
+        case ImageFile::RIGHT:
+            size.setWidth(size.width() - size.width() / 2);
+            break;
+        default:
+            break;
+    }
+    return size;
+}
+
 void
 PlaylistModel::setModelToItemView(QAbstractItemView *view)
 {
@@ -207,14 +477,9 @@ PlaylistModel::setModelToItemView(QAbstractItemView *view)
 void
 PlaylistModel::openImages(const QStringList &path)
 {
-    bool req_refresh = (count() < 2);
-    int c = openFilesAndDirs(path, getOpenDirLevel());
-    if (req_refresh && !empty())
-    {
-        dataChangeNotice(0, 0);
-        showImages();
-    }
-    if (c > 0) emit changePlaylistStatus();
+    // 前に開こうとしていたものはたどるのをやめる
+    lister.clear();
+    lister.putRequest(path, getOpenDirLevel());
 }
 
 void
@@ -261,6 +526,30 @@ PlaylistModel::changeNumOfImages(int n)
     if (c) emit changePlaylistStatus();
 }
 
+void
+PlaylistModel::changeRightbinding(bool rb)
+{
+    if (rbind == rb) return;
+    rbind = rb;
+
+    // 分割したページの並びを綴じ方に合わせて入れ替える
+    bool c = false;
+    for (int row = 0; row + 1 < count(); ++row)
+    {
+        if (!isSplitPair(row)) continue;
+        files[row]->setHalf(rbind ? ImageFile::RIGHT : ImageFile::LEFT);
+        files[row+1]->setHalf(rbind ? ImageFile::LEFT : ImageFile::RIGHT);
+        emit dataChanged(index(row, 0), index(row+1, 0));
+        c = true;
+        row++;
+    }
+    if (c)
+    {
+        showImages();
+        emit changePlaylistStatus();
+    }
+}
+
 void
 PlaylistModel::itemViewDoubleClicked(const QModelIndex &img_index)
 {
@@ -268,6 +557,27 @@ PlaylistModel::itemViewDoubleClicked(const QModelIndex &img_index)
     showSelectedItem();
 }
 
+void
+PlaylistModel::imageProbed(const QString &key, const QSize &size,
+        const QByteArray &format, qint64 bytes)
+{
+    PageInfo info;
+    info.size = size;
+    info.format = format;
+    info.bytes = bytes;
+    pageinfo.insert(key, info);
+
+    if (!split_wide || !isWideSize(size)) return;
+    const int row = findWidePage(key);
+    if (row < 0) return;
+
+    const bool cur = (row == currentIndex(0) || row == currentIndex(1));
+    splitPage(row);
+    probe_row = row + 2;
+    if (cur) showImages();
+    emit changePlaylistStatus();
+}
+
 int
 PlaylistModel::nextIndex(int idx, int c) const
 {
@@ -339,112 +649,584 @@ PlaylistModel::dataChangeNotice(int newidx, int newnum)
     }
 }
 
-int
-PlaylistModel::openFilesAndDirs(const QStringList &paths, int level)
+void
+PlaylistModel::appendFiles(const QVector<ImageFile*> &openfiles)
 {
-    QVector<ImageFile*> openfiles;
-    openFilesAndDirs0(openfiles, paths, level);
-    if (!openfiles.empty())
+    if (openfiles.empty()) return;
+    beginInsertRows(QModelIndex(), rowCount(),
+            rowCount() + openfiles.count() - 1);
+    files.append(openfiles);
+    endInsertRows();
+    for (auto iter = openfiles.cbegin(); iter != openfiles.cend(); ++iter)
     {
-        int c = openfiles.count();
-        beginInsertRows(QModelIndex(), rowCount(),
-                rowCount() + c - 1);
-        files.append(openfiles);
-        endInsertRows();
-        openfiles.clear();
-        return c;
+        trackUnindexed(*iter);
     }
-    return 0;
 }
 
 void
-PlaylistModel::openFilesAndDirs0(QVector<ImageFile*> &openfiles,
-        const QStringList &paths, int level)
+PlaylistModel::insertFiles(const QVector<ImageFile*> &openfiles)
 {
-    if (paths.empty()) return;
-
-    for (auto iter = paths.cbegin();
-            iter != paths.cend(); ++iter)
+    // 名前順に届くので，位置は続けて入れられなくなったときだけ探し直し，
+    // 続けて入れるものはまとめて1つの範囲として入れる
+    int i = 0;
+    while (i < openfiles.count())
     {
-        const QFileInfo info(*iter);
-        if (info.isFile())
+        QString prev = openfiles[i]->physicalFilePath();
+        const QString dir = parentDir(prev);
+        const int pos = insertPosition(prev);
+        int n = 1;
+        while (i + n < openfiles.count())
         {
-            if (ImageFile::isReadableImageFile(*iter))
+            // 同じ書庫のエントリは書庫の中の順のまま続けて並べる
+            const QString path = openfiles[i + n]->physicalFilePath();
+            if (path == prev)
             {
-                ImageFile *imgfile = new ImageFile(*iter);
-                openfiles.append(imgfile);
+                n++;
+                continue;
             }
-            else
+            // 別のディレクトリのものは位置を探し直す
+            if (parentDir(path) != dir || (pos < count() &&
+                    !pathLess(path, files[pos]->physicalFilePath())))
             {
-                QVector<ImageFile*> imgfiles =
-                    ImageFile::openArchive(*iter);
-                openfiles.append(imgfiles);
-                imgfiles.clear();
+                break;
             }
+            prev = path;
+            n++;
+        }
+
+        beginInsertRows(QModelIndex(), pos, pos + n - 1);
+        files.insert(pos, n, nullptr);
+        for (int k = 0; k < n; ++k)
+        {
+            files[pos + k] = openfiles[i + k];
+            trackUnindexed(openfiles[i + k]);
+        }
+        endInsertRows();
+        if (pos <= img_index) img_index += n;
+        if (pos < probe_row) probe_row += n;
+        i += n;
+    }
+}
+
+int
+PlaylistModel::insertPosition(const QString &path) const
+{
+    // 同じディレクトリに並んでいるものがなければ，監視している
+    // ディレクトリをさかのぼって探す
+    QString dir = parentDir(path);
+    for (;;)
+    {
+        const QString prefix = dir + '/';
+        int last = -1;
+        for (int row = 0; row < count(); ++row)
+        {
+            const QString p = files[row]->physicalFilePath();
+            if (!p.startsWith(prefix)) continue;
+            if (pathLess(path, p)) return row;
+            last = row;
+        }
+        if (last >= 0) return last + 1;
+
+        dir = parentDir(dir);
+        if (!watched.contains(dir)) return count();
+    }
+}
+
+// pathsのファイルとpathsのディレクトリの下にあるファイルを取り除く
+void
+PlaylistModel::removeFiles(const QSet<QString> &paths)
+{
+    if (paths.empty()) return;
+
+    bool c = false;
+    for (int row = 0; row < count(); ++row)
+    {
+        if (!isUnder(files[row]->physicalFilePath(), paths)) continue;
+        // 同じ名前で置き換えられていても古い内容を使わないようにする
+        prft.remove(files[row]->createKey());
+        pageinfo.remove(files[row]->createKey());
+        forgetUnindexed(files[row]);
+        delete files[row];
+        files[row] = nullptr;
+        c = true;
+    }
+    if (c) removeNullFiles();
+}
+
+void
+PlaylistModel::watchDirs(const QVector<FileLister::Dir> &dirs)
+{
+    if (!watch_dirs) return;
+
+    const QDateTime now = QDateTime::currentDateTime();
+    for (auto iter = dirs.cbegin(); iter != dirs.cend(); ++iter)
+    {
+        if (!watched.contains(iter->path))
+        {
+            // 上限を超えた分は監視しない
+            if (watched.count() >= max_watched_dirs) continue;
+            watcher.addPath(iter->path);
+        }
+        WatchedDir &w = watched[iter->path];
+        w.level = iter->level;
+        w.names.clear();
+        for (auto name = iter->names.cbegin(); name != iter->names.cend();
+                ++name)
+        {
+            w.names << *name;
+        }
+        w.checked = now;
+    }
+}
+
+void
+PlaylistModel::unwatch(const QSet<QString> &paths)
+{
+    for (auto iter = watched.begin(); iter != watched.end(); )
+    {
+        if (isUnder(iter.key(), paths))
+        {
+            watcher.removePath(iter.key());
+            iter = watched.erase(iter);
+        }
+        else
+        {
+            ++iter;
+        }
+    }
+
+    // 置き換えられただけのファイルは監視を続ける
+    for (auto iter = watched_files.begin(); iter != watched_files.end(); )
+    {
+        if (isUnder(iter.key(), paths) && !QFileInfo(iter.key()).exists())
+        {
+            watcher.removePath(iter.key());
+            iter = watched_files.erase(iter);
         }
-        else if (level > 0)
+        else
+        {
+            ++iter;
+        }
+    }
+}
+
+void
+PlaylistModel::unwatchAll()
+{
+    const QStringList paths = watcher.directories() + watcher.files();
+    if (!paths.empty()) watcher.removePaths(paths);
+    watched.clear();
+    watched_files.clear();
+    changed_dirs.clear();
+    changed_files.clear();
+    watch_timer.stop();
+    settle_timer.stop();
+}
+
+// 書き込み途中かもしれないので，変わらなくなるまで監視する
+void
+PlaylistModel::watchFile(const QString &path)
+{
+    if (!watched_files.contains(path)) watcher.addPath(path);
+    watched_files.insert(path, QDateTime::currentDateTime());
+    if (!settle_timer.isActive()) settle_timer.start(settle_delay);
+}
+
+// 前に調べたときとの違いから，取り除くものと読み直すものを求める
+void
+PlaylistModel::updateDir(const QString &dir, QSet<QString> &removed,
+        QMap<int, QStringList> &added)
+{
+    WatchedDir &w = watched[dir];
+    if (!QFileInfo(dir).isDir())
+    {
+        removed << dir;
+        return;
+    }
+
+    QSet<QString> names;
+    QDirIterator iter(dir, QDir::AllEntries | QDir::NoDotAndDotDot);
+    while (iter.hasNext())
+    {
+        iter.next();
+        const QFileInfo info = iter.fileInfo();
+        const bool found = !w.names.contains(iter.fileName());
+        names << iter.fileName();
+        if (info.isDir())
         {
-            QStringList newlist;
-            const QFileInfoList entrylist = QDir(*iter).entryInfoList();
-            const int clen = info.canonicalPath().length();
-            for (auto iter2 = entrylist.cbegin();
-                    iter2 != entrylist.cend(); ++iter2)
+            if (found && w.level > 0 && !info.isSymLink())
             {
-                if (clen < iter2->canonicalPath().length())
-                {
-                    newlist << iter2->filePath();
-                }
+                added[w.level] << info.filePath();
             }
-            openFilesAndDirs0(openfiles, newlist, level-1);
         }
+        else if (found)
+        {
+            watchFile(info.filePath());
+            added[w.level] << info.filePath();
+        }
+        else if (info.lastModified() > w.checked)
+        {
+            // 同じ名前で置き換えられたものは一度取り除いて読み直す
+            removed << info.filePath();
+            added[w.level] << info.filePath();
+        }
+    }
+
+    for (auto name = w.names.cbegin(); name != w.names.cend(); ++name)
+    {
+        if (!names.contains(*name)) removed << dir + '/' + *name;
+    }
+    w.names.swap(names);
+    w.checked = QDateTime::currentDateTime();
+}
+
+bool
+PlaylistModel::isWidePage(const ImageFile &f) const
+{
+    if (f.half() != ImageFile::WHOLE) return false;
+    return isWideSize(pageinfo.value(f.createKey()).size);
+}
+
+int
+PlaylistModel::findWidePage(const QString &key) const
+{
+    // ヘッダはおおむね並び順に調べられるので前回の続きから探す．
+    // 同じキーの行は1つか，分けた後の2つだけなので最初の行で決まる
+    const int n = count();
+    for (int i = 0; i < n; ++i)
+    {
+        const int row = (probe_row + i) % n;
+        if (files[row]->createKey() == key)
+        {
+            return isWidePage(*files[row]) ? row : -1;
+        }
+    }
+    return -1;
+}
+
+void
+PlaylistModel::splitPage(int row)
+{
+    ImageFile *second = new ImageFile(*files[row]);
+    files[row]->setHalf(rbind ? ImageFile::RIGHT : ImageFile::LEFT);
+    second->setHalf(rbind ? ImageFile::LEFT : ImageFile::RIGHT);
+
+    beginInsertRows(QModelIndex(), row + 1, row + 1);
+    files.insert(row + 1, second);
+    endInsertRows();
+    trackUnindexed(second);
+    emit dataChanged(index(row, 0), index(row, 0));
+    if (row < img_index) img_index++;
+}
+
+void
+PlaylistModel::mergePage(int row)
+{
+    if (isSplitPair(row))
+    {
+        beginRemoveRows(QModelIndex(), row + 1, row + 1);
+        forgetUnindexed(files[row + 1]);
+        delete files[row + 1];
+        files.remove(row + 1);
+        endRemoveRows();
+        if (row < img_index) img_index--;
     }
+    files[row]->setHalf(ImageFile::WHOLE);
+    emit dataChanged(index(row, 0), index(row, 0));
+}
+
+bool
+PlaylistModel::isSplitPair(int row) const
+{
+    if (row + 1 >= count()) return false;
+    const ImageFile &a = *files[row];
+    const ImageFile &b = *files[row + 1];
+    return a.half() != ImageFile::WHOLE &&
+        b.half() != ImageFile::WHOLE &&
+        a.half() != b.half() &&
+        a.createKey() == b.createKey();
 }
 
 void
 PlaylistModel::showImages()
 {
+    // 前のページの読み込みは捨てる
+    loader.cancel(++load_gen);
+    page_shown = false;
+
     int n = std::min(count(), 2);
-    if (n == 2)
+    for (int i = 0; i < 2; ++i)
     {
-        emit changeImages(
-                loadData(*files[currentIndex(0)]),
-                loadData(*files[currentIndex(1)]));
+        page_files[i] = (i < n) ? *files[currentIndex(i)] : ImageFile();
+        page_imgs[i] = QImage();
+        page_anims[i].clear();
+        page_ready[i] = true;
     }
-    else if (n == 1)
+    // 同じ画像の左右なら一度だけ読み込んで両方のページに使う
+    page_shared = (n == 2 &&
+            page_files[0].half() != ImageFile::WHOLE &&
+            page_files[1].half() != ImageFile::WHOLE &&
+            page_files[0].createKey() == page_files[1].createKey());
+
+    for (int i = 0; i < (page_shared ? 1 : n); ++i)
     {
-        emit changeImages(
-                loadData(*files[currentIndex(0)]),
-                QImage());
+        const ImageFile &f = page_files[i];
+        QImage img;
+        if (loadCachedData(f, img, page_anims[i]))
+        {
+            setPageImage(i, img, true);
+        }
+        else
+        {
+            // 大きさが分かっていれば仮の画像ですぐにページを切り替える
+            img = blankPage(f);
+            setPageImage(i, img, !img.isNull());
+            loader.putRequest(load_gen, i, f, jpeg_opts);
+        }
+        // 分割したページはアニメーションさせない
+        if (f.half() != ImageFile::WHOLE) page_anims[i].clear();
     }
-    else
+    emitImages();
+}
+
+void
+PlaylistModel::setPageImage(int slot, const QImage &img, bool ready)
+{
+    // 分割したページには元の画像の片側だけを渡す
+    page_imgs[slot] = halfView(img, page_files[slot].half());
+    page_ready[slot] = ready;
+    if (page_shared && slot == 0)
     {
-        emit changeImages(QImage(), QImage());
+        page_imgs[1] = halfView(img, page_files[1].half());
+        page_ready[1] = ready;
     }
 }
 
-QImage
-PlaylistModel::loadData(const ImageFile &f)
+void
+PlaylistModel::emitImages()
 {
-    QImage img;
-    QByteArray *data = prft.get(f.createKey());
-    if (data)
+    // どのページにも画像が揃うまでは前のページを表示しておく
+    if (!page_ready[0] || !page_ready[1]) return;
+
+    // 見開きにするかどうかは読み込む前に分かる大きさで決めさせる
+    emit changePageSizes(pageSize(page_files[0]), pageSize(page_files[1]));
+    if (page_shown)
     {
-        fprintf(stderr, "cache hit\n");
-        img.loadFromData(*data);
+        emit updateImages(page_imgs[0], page_imgs[1]);
     }
     else
+    {
+        page_shown = true;
+        emit changeImages(page_imgs[0], page_imgs[1]);
+    }
+    emitAnimations();
+}
+
+void
+PlaylistModel::emitAnimations()
+{
+    for (int i = 0; i < 2; ++i)
+    {
+        if (!page_anims[i].isEmpty())
+        {
+            emit changeAnimation(i, page_anims[i]);
+            page_anims[i].clear();
+        }
+    }
+}
+
+void
+PlaylistModel::pageLoaded(int gen, int slot, const QImage &img,
+        bool partial)
+{
+    Q_UNUSED(partial);
+    if (gen != load_gen) return;
+
+    setPageImage(slot, img, true);
+    emitImages();
+}
+
+void
+PlaylistModel::pageAnimated(int gen, int slot, const QByteArray &data)
+{
+    if (gen != load_gen) return;
+    if (page_files[slot].half() != ImageFile::WHOLE) return;
+
+    page_anims[slot] = data;
+    if (page_shown) emitAnimations();
+}
+
+void
+PlaylistModel::filesListed()
+{
+    const QVector<FileLister::Result> results = lister.takeResults();
+    if (results.empty()) return;
+
+    const bool req_refresh = (count() < 2);
+    for (auto iter = results.cbegin(); iter != results.cend(); ++iter)
+    {
+        watchDirs(iter->dirs);
+        if (!iter->done)
+        {
+            if (iter->insert) insertFiles(iter->files);
+            else appendFiles(iter->files);
+            continue;
+        }
+
+        // 索引ができるまでは調べずにおいたページをまとめて調べる．
+        // 見るのはこの書庫の索引を待っているページだけにする
+        QVector<ImageFile> list;
+        const QVector<ImageFile*> pending = unindexed.take(iter->archive);
+        if (iter->index)
+        {
+            for (auto f = pending.cbegin(); f != pending.cend(); ++f)
+            {
+                if (!iter->index->find((*f)->rawFilePath())) continue;
+                (*f)->setArchiveIndex(iter->index);
+                if ((*f)->half() == ImageFile::WHOLE) list << **f;
+            }
+            for (auto f = iter->files.cbegin(); f != iter->files.cend(); ++f)
+            {
+                if ((*f)->fileType() == ImageFile::ARCHIVE &&
+                        !(*f)->archiveIndex() &&
+                        (*f)->physicalFilePath() == iter->archive &&
+                        iter->index->find((*f)->rawFilePath()))
+                {
+                    (*f)->setArchiveIndex(iter->index);
+                }
+            }
+        }
+        if (iter->insert) insertFiles(iter->files);
+        else appendFiles(iter->files);
+        for (auto f = iter->files.cbegin(); f != iter->files.cend(); ++f)
+        {
+            list << **f;
+        }
+        prober.putRequest(list);
+    }
+
+    if (req_refresh && !empty())
+    {
+        dataChangeNotice(0, 0);
+        showImages();
+    }
+    emit changePlaylistStatus();
+}
+
+void
+PlaylistModel::directoryChanged(const QString &path)
+{
+    changed_dirs << path;
+    watch_timer.start(watch_delay);
+}
+
+void
+PlaylistModel::fileChanged(const QString &path)
+{
+    changed_files << path;
+    if (watched_files.contains(path))
+    {
+        watched_files.insert(path, QDateTime::currentDateTime());
+    }
+    watch_timer.start(watch_delay);
+}
+
+void
+PlaylistModel::settleFiles()
+{
+    // 変わるたびに読み直しているので，最後の内容はもう読んである
+    const QDateTime now = QDateTime::currentDateTime();
+    for (auto iter = watched_files.begin(); iter != watched_files.end(); )
+    {
+        if (iter.value().msecsTo(now) >= settle_delay)
+        {
+            watcher.removePath(iter.key());
+            iter = watched_files.erase(iter);
+        }
+        else
+        {
+            ++iter;
+        }
+    }
+    if (!watched_files.empty()) settle_timer.start(settle_delay);
+}
+
+void
+PlaylistModel::applyChanges()
+{
+    QSet<QString> removed;
+    QMap<int, QStringList> added;   // たどる深さごとにまとめる
+    for (auto iter = changed_dirs.cbegin(); iter != changed_dirs.cend();
+            ++iter)
+    {
+        if (watched.contains(*iter)) updateDir(*iter, removed, added);
+    }
+
+    QSet<QString> reading;
+    for (auto iter = added.cbegin(); iter != added.cend(); ++iter)
+    {
+        for (auto path = iter.value().cbegin(); path != iter.value().cend();
+                ++path)
+        {
+            reading << *path;
+        }
+    }
+    for (auto iter = changed_files.cbegin(); iter != changed_files.cend();
+            ++iter)
+    {
+        // 消えたものはディレクトリの変更で分かる
+        if (reading.contains(*iter) || !QFileInfo(*iter).isFile()) continue;
+        removed << *iter;
+        added[0] << *iter;
+    }
+    changed_dirs.clear();
+    changed_files.clear();
+
+    unwatch(removed);
+    removeFiles(removed);
+    for (auto iter = added.begin(); iter != added.end(); ++iter)
+    {
+        // 名前順に並べておけば，届いた順にまとめて入れられる
+        std::sort(iter.value().begin(), iter.value().end(), pathLess);
+        lister.putRequest(iter.value(), iter.key(), true);
+    }
+}
+
+bool
+PlaylistModel::loadCachedData(const ImageFile &f, QImage &img,
+        QByteArray &anim)
+{
+    // ページや圧縮して持っている画像はデコードした状態でキャッシュされている
+    ImageFile::Data data;
+    const bool decoded = prft.getImage(f.createKey(), img);
+    if (!decoded && (f.fileType() == ImageFile::PAGE ||
+                !prft.get(f.createKey(), data)))
     {
         fprintf(stderr, "cache miss\n");
-        data = f.readData();
-        if (!data) return QImage();
-        img.loadFromData(*data);
-        delete data;
+        return false;
     }
+    fprintf(stderr, "cache hit\n");
+    if (decoded) return true;
 
-    if (img.format() != QImage::Format_ARGB32)
+    Decoder::decode(data.bytes, f.format(), img, jpeg_opts);
+    img = Decoder::toDisplayFormat(img);
+    if (!img.isNull() &&
+            AnimationDecoder::isAnimated(data.bytes, f.format()))
     {
-        return img.convertToFormat(QImage::Format_ARGB32);
+        // マップした領域を指していることがあるので再生用にはコピーする
+        anim = QByteArray(data.bytes.constData(), data.bytes.size());
     }
-    return img;
+    return true;
 }
 
+QImage
+PlaylistModel::blankPage(const ImageFile &f) const
+{
+    const QSize size = pageinfo.value(f.createKey()).size;
+    if (size.isEmpty()) return QImage();
+
+    QImage img(std::max(1, size.width() / 32),
+            std::max(1, size.height() / 32), QImage::Format_RGB32);
+    img.fill(Qt::darkGray);
+    return PageLoader::makePlaceholder(img, size);
+}
@@ -9,8 +9,18 @@
 #include <QImage>
 #include <QItemSelectionModel>
 #include <QVector>
+#include <QHash>
+#include <QSet>
+#include <QMap>
+#include <QSize>
+#include <QDateTime>
+#include <QTimer>
+#include <QFileSystemWatcher>
 #include "ImageFile.hpp"
 #include "Prefetcher.hpp"
+#include "Prober.hpp"
+#include "PageLoader.hpp"
+#include "FileLister.hpp"
 
 class PlaylistModel : public QAbstractListModel
 {
@@ -28,16 +38,32 @@ public:
 
     void setOpenDirLevel(int n);
     int getOpenDirLevel() const;
+    // 並行して読むディレクトリの数
+    void setOpenDirThreads(int n);
+    int getOpenDirThreads() const;
+    // 開いたディレクトリを監視して変更を反映するか
+    void setWatchDirs(bool watch);
+    bool getWatchDirs() const;
 
     void setCacheSize(int n);
     int getCacheSize() const;
 
+    void setPackedCacheSize(int mib);
+    int getPackedCacheSize() const;
+
+    void setFastDecode(bool fast);
+    bool getFastDecode() const;
+
+    void setSplitWidePages(bool split);
+    bool getSplitWidePages() const;
+
     int countShowImages() const;
     int count() const;
     bool empty() const;
 
     int currentIndex(int i) const;
     QString currentFileName(int i) const;
+    QSize imageSize(int i) const;
 
     void setModelToItemView(QAbstractItemView *view);
 
@@ -46,33 +72,118 @@ public slots:
     void nextImage();
     void prevImage();
     void changeNumOfImages(int n);
+    void changeRightbinding(bool rbind);
 
 signals:
     void changeImages(const QImage &img_l, const QImage &img_r);
+    // 表示中のページの画像が(途中経過から)更新された
+    void updateImages(const QImage &img_l, const QImage &img_r);
+    // slot番目のページがアニメーション画像だった
+    void changeAnimation(int slot, const QByteArray &data);
+    // 表示するページの画像の本来の大きさ(分からなければ空)
+    void changePageSizes(const QSize &size_l, const QSize &size_r);
     void changePlaylistStatus();
 
 private slots:
     void itemViewDoubleClicked(const QModelIndex &index);
+    void imageProbed(const QString &key, const QSize &size,
+            const QByteArray &format, qint64 bytes);
+    void pageLoaded(int gen, int slot, const QImage &img, bool partial);
+    void pageAnimated(int gen, int slot, const QByteArray &data);
+    void filesListed();
+    void directoryChanged(const QString &path);
+    void fileChanged(const QString &path);
+    void applyChanges();
+    void settleFiles();
 
 private:
+    // デコードせずにヘッダから得たページの情報
+    struct PageInfo
+    {
+        QSize size;
+        QByteArray format;
+        qint64 bytes;
+    };
+    // 開いたディレクトリの変更を反映するために監視している状態
+    struct WatchedDir
+    {
+        int level;              // この下をたどる深さ
+        QSet<QString> names;    // 前に調べたときにあったエントリ
+        QDateTime checked;      // 前に調べた時刻
+    };
+
     QItemSelectionModel *slct;
     QVector<ImageFile*> files;
     int opendirlevel;
     int img_index;
     int img_num;
+    int jpeg_opts;
+    bool split_wide;        // 横長のページを左右2ページに分ける
+    bool rbind;             // 右綴じなら右側を先のページにする
+    int probe_row;          // 次に調べられそうな行
     Prefetcher prft;
+    Prober prober;
+    QHash<QString, PageInfo> pageinfo;
+    PageLoader loader;
+    FileLister lister;
+    // 索引ができるのを待っている書庫のページ．キーは書庫のパス
+    QHash<QString, QVector<ImageFile*>> unindexed;
+    int load_gen;           // showImagesごとに増やす
+    ImageFile page_files[2];    // 表示するページ
+    bool page_shared;       // 2ページとも同じ画像の左右か
+    QImage page_imgs[2];    // 表示するページの画像
+    bool page_ready[2];     // 途中経過を含めて画像があるか
+    bool page_shown;        // changeImagesを通知済みか
+    QByteArray page_anims[2];   // 再生を通知していないアニメーション
+    bool watch_dirs;
+    QFileSystemWatcher watcher;
+    QHash<QString, WatchedDir> watched;
+    // 書き込み途中かもしれないファイルと最後に変わった時刻
+    QHash<QString, QDateTime> watched_files;
+    QSet<QString> changed_dirs;
+    QSet<QString> changed_files;
+    QTimer watch_timer;     // 続けて届いた変更をまとめて反映する
+    QTimer settle_timer;    // 変わらなくなったファイルの監視をやめる
+
+    static const int watch_delay = 300;
+    // この間変わらなければ書き終わったとみなす(ms)
+    static const int settle_delay = 3000;
+    // inotifyの上限に近づかないように監視するディレクトリの数
+    static const int max_watched_dirs = 1024;
 
     int nextIndex(int idx, int c) const;
     bool isValidIndex(int i) const;
     bool isCurrentIndex(int i) const;
 
     void dataChangeNotice(int newidx, int newnum);
-    int openFilesAndDirs(const QStringList &paths, int level);
-    void openFilesAndDirs0(QVector<ImageFile*> &openfiles,
-            const QStringList &paths, int level);
+    void appendFiles(const QVector<ImageFile*> &openfiles);
+    void insertFiles(const QVector<ImageFile*> &openfiles);
+    int insertPosition(const QString &path) const;
+    void removeFiles(const QSet<QString> &paths);
+    void removeNullFiles();
+    void trackUnindexed(ImageFile *f);
+    void forgetUnindexed(ImageFile *f);
+
+    void watchDirs(const QVector<FileLister::Dir> &dirs);
+    void unwatch(const QSet<QString> &paths);
+    void unwatchAll();
+    void watchFile(const QString &path);
+    void updateDir(const QString &dir, QSet<QString> &removed,
+            QMap<int, QStringList> &added);
+
+    bool isWidePage(const ImageFile &f) const;
+    int findWidePage(const QString &key) const;
+    void splitPage(int row);
+    void mergePage(int row);
+    bool isSplitPair(int row) const;
 
     void showImages();
-    QImage loadData(const ImageFile &f);
+    void setPageImage(int slot, const QImage &img, bool ready);
+    void emitImages();
+    void emitAnimations();
+    bool loadCachedData(const ImageFile &f, QImage &img, QByteArray &anim);
+    QImage blankPage(const ImageFile &f) const;
+    QSize pageSize(const ImageFile &f) const;
 };
 
 #endif // PLAYLISTMODEL_HPP
@@ -1,8 +1,16 @@
+#include <QSet>
+#include <algorithm>
 #include "Prefetcher.hpp"
+#include "TiffPages.hpp"
+#include "Decoder.hpp"
+#include "AnimationDecoder.hpp"
 
 Prefetcher::Prefetcher(QObject *parent)
     : QThread(parent)
     , cache(20)
+    , img_cache(20)
+    , packed_cache(0)
+    , decode_opts(0)
     , task_no(0)
     , task_filled(0)
 {
@@ -24,8 +32,11 @@ Prefetcher::~Prefetcher()
         delete worker[i];
     }
     cache.clear();
+    img_cache.clear();
+    packed_cache.clear();
     files.clear();
     reqfiles.clear();
+    jobs.clear();
 }
 
 void
@@ -38,14 +49,52 @@ Prefetcher::putRequest(const QVector<ImageFile> &tasks)
     mutex_req.unlock();
 }
 
-QByteArray *
-Prefetcher::get(const QString &key)
+bool
+Prefetcher::get(const QString &key, ImageFile::Data &data)
 {
-    QByteArray *data = nullptr;
+    // 使っている間に追い出されてもよいようにコピーを返す
+    bool ret = false;
     mutex.lock();
-    if (cache.contains(key)) data = cache[key];
+    if (cache.contains(key))
+    {
+        data = *cache[key];
+        ret = true;
+    }
+    mutex.unlock();
+    return ret;
+}
+
+bool
+Prefetcher::getImage(const QString &key, QImage &img)
+{
+    mutex.lock();
+    if (img_cache.contains(key))
+    {
+        img = *img_cache[key];
+        mutex.unlock();
+        return true;
+    }
+    if (!packed_cache.contains(key))
+    {
+        mutex.unlock();
+        return false;
+    }
+    // 展開している間に追い出されてもよいようにコピーしておく
+    const PackedImage packed(*packed_cache[key]);
+    mutex.unlock();
+
+    img = packed.unpack();
+    return !img.isNull();
+}
+
+void
+Prefetcher::remove(const QString &key)
+{
+    mutex.lock();
+    cache.remove(key);
+    img_cache.remove(key);
+    packed_cache.remove(key);
     mutex.unlock();
-    return data;
 }
 
 void
@@ -53,6 +102,7 @@ Prefetcher::setCacheSize(int n)
 {
     mutex.lock();
     cache.setMaxCost(n);
+    img_cache.setMaxCost(n);
     mutex.unlock();
 }
 
@@ -62,6 +112,28 @@ Prefetcher::getCacheSize() const
     return cache.maxCost();
 }
 
+void
+Prefetcher::setPackedCacheSize(int mib)
+{
+    mutex.lock();
+    packed_cache.setMaxCost(PackedImage::isAvailable() ? mib * 1024 : 0);
+    mutex.unlock();
+}
+
+int
+Prefetcher::getPackedCacheSize() const
+{
+    return packed_cache.maxCost() / 1024;
+}
+
+void
+Prefetcher::setDecodeOptions(int options)
+{
+    mutex.lock();
+    decode_opts = options;
+    mutex.unlock();
+}
+
 void
 Prefetcher::run()
 {
@@ -82,6 +154,7 @@ Prefetcher::run()
                 task_filled = 0;
                 files.clear();
                 files = reqfiles;
+                taken = QVector<bool>(files.count(), false);
                 reqfiles.clear();
                 cond_get.wakeAll();
                 mutex.unlock();
@@ -100,50 +173,233 @@ Prefetcher::run()
     }
 }
 
-ImageFile *
-Prefetcher::getTask()
+// デコード待ちの仕事があればjobに入れてtrueを返す．そうでなければ
+// 次に取り出すファイルをbatchに入れる．書庫のエントリなら同じ書庫の
+// 残りの要求もまとめて，書庫の中の順に並べて一度の走査で読ませる
+bool
+Prefetcher::getTask(QVector<ImageFile> &batch, Job &job)
 {
-    ImageFile *f;
+    batch.clear();
     mutex.lock();
     for (;;)
     {
-        while (task_no >= files.count())
+        while (task_no >= files.count() && jobs.empty())
         {
             cond_get.wait(&mutex);
         }
-        f = &files[task_no];
-        task_no++;
+        if (!jobs.empty())
+        {
+            job = jobs.takeFirst();
+            mutex.unlock();
+            return true;
+        }
 
-        QString k = f->createKey();
-        if (cache.contains(k))
+        const int k = task_no++;
+        if (taken[k]) continue;
+        const ImageFile &f = files[k];
+        if (isCached(f.createKey()))
         {
-            cache[k]; // update
-            task_filled++;
-            if (task_filled >= files.count())
+            taskFilled();
+            continue;
+        }
+        batch << f;
+
+        if (f.fileType() == ImageFile::ARCHIVE && f.archiveOrder() >= 0)
+        {
+            QSet<QString> keys;
+            keys << f.createKey();
+            for (int j = k + 1; j < files.count(); ++j)
+            {
+                const ImageFile &g = files[j];
+                if (taken[j] || !g.isSameArchive(f))
+                {
+                    continue;
+                }
+                taken[j] = true;
+                // 分割したページは同じエントリなので一度だけ読む
+                if (isCached(g.createKey()) || keys.contains(g.createKey()))
+                {
+                    taskFilled();
+                }
+                else
+                {
+                    keys << g.createKey();
+                    batch << g;
+                }
+            }
+            std::sort(batch.begin(), batch.end(),
+                    [](const ImageFile &x, const ImageFile &y)
+                    {
+                        return x.archiveOrder() < y.archiveOrder();
+                    });
+        }
+        break;
+    }
+    mutex.unlock();
+    return false;
+}
+
+void
+Prefetcher::putJob(const ImageFile &f, const ImageFile::Data &data)
+{
+    Job job = {f, data};
+    mutex.lock();
+    jobs << job;
+    cond_get.wakeOne();
+    mutex.unlock();
+}
+
+void
+Prefetcher::fetch(const QVector<ImageFile> &batch)
+{
+    int options;
+    const bool packing = isPacking(options);
+    for (auto iter = batch.cbegin(); iter != batch.cend(); ++iter)
+    {
+        const ImageFile &f = *iter;
+        if (f.fileType() == ImageFile::PAGE)
+        {
+            // 同じファイルの別のページも各ワーカーで並行してデコードできる
+            QImage img;
+            TiffPages::decode(f.physicalFilePath(), f.pageOffset(), img);
+            img = Decoder::toDisplayFormat(img);
+            if (img.isNull())
             {
-                cond_put.wakeOne();
+                // 読めなかったページはキャッシュしない
+                mutex.lock();
+                taskFilled();
+                mutex.unlock();
+            }
+            else if (packing)
+            {
+                setPackedResult(f.createKey(), new PackedImage(img));
+            }
+            else
+            {
+                setImageResult(f.createKey(), new QImage(img));
             }
+            continue;
+        }
+
+        ImageFile::Data data;
+        f.readData(data);
+        if (packing && !data.bytes.isEmpty() && batch.count() > 1)
+        {
+            // 取り出しを続けている間にデコードは他のワーカーに任せる
+            putJob(f, data);
         }
         else
         {
-            break;
+            storeData(f, data);
+        }
+    }
+}
+
+void
+Prefetcher::storeData(const ImageFile &f, const ImageFile::Data &data)
+{
+    int options;
+    if (isPacking(options) && !data.bytes.isEmpty() &&
+            !AnimationDecoder::isAnimated(data.bytes, f.format()))
+    {
+        // 表示するときにデコードしなくて済むよう展開して圧縮しておく
+        QImage img;
+        if (Decoder::decode(data.bytes, f.format(), img, options))
+        {
+            PackedImage *packed =
+                new PackedImage(Decoder::toDisplayFormat(img));
+            if (!packed->isNull())
+            {
+                setPackedResult(f.createKey(), packed);
+                return;
+            }
+            delete packed;
         }
     }
+
+    // 置いておく間にファイルや書庫が切り詰められると，マップした領域を
+    // 読んだときにSIGBUSになる．ファイルの内容はコピーして持つ
+    if (data.map)
+    {
+        ImageFile::Data owned;
+        owned.bytes = QByteArray(data.bytes.constData(), data.bytes.size());
+        setResult(f.createKey(), owned);
+        return;
+    }
+    setResult(f.createKey(), data);
+}
+
+void
+Prefetcher::setResult(const QString &key, const ImageFile::Data &data)
+{
+    mutex.lock();
+    if (!data.bytes.isEmpty())
+    {
+        cache.insert(key, new ImageFile::Data(data), 1);
+    }
+    taskFilled();
+    mutex.unlock();
+}
+
+void
+Prefetcher::setImageResult(const QString &key, QImage *img)
+{
+    mutex.lock();
+    img_cache.insert(key, img, 1);
+    taskFilled();
     mutex.unlock();
-    return f;
 }
 
 void
-Prefetcher::setResult(const QString &key, QByteArray *data)
+Prefetcher::setPackedResult(const QString &key, PackedImage *img)
 {
     mutex.lock();
-    cache.insert(key, data, 1);
+    packed_cache.insert(key, img, img->cost());
+    taskFilled();
+    mutex.unlock();
+}
+
+bool
+Prefetcher::isPacking(int &options)
+{
+    mutex.lock();
+    const bool ret = packed_cache.maxCost() > 0;
+    options = decode_opts;
+    mutex.unlock();
+    return ret;
+}
+
+// mutexをロックしてから呼ぶこと．見つかれば最近使ったことにする
+bool
+Prefetcher::isCached(const QString &key)
+{
+    if (cache.contains(key))
+    {
+        cache[key];
+        return true;
+    }
+    if (img_cache.contains(key))
+    {
+        img_cache[key];
+        return true;
+    }
+    if (packed_cache.contains(key))
+    {
+        packed_cache[key];
+        return true;
+    }
+    return false;
+}
+
+// mutexをロックしてから呼ぶこと
+void
+Prefetcher::taskFilled()
+{
     task_filled++;
     if (task_filled >= files.count())
     {
         cond_put.wakeOne();
     }
-    mutex.unlock();
 }
 
 Prefetcher::Worker::Worker(Prefetcher *parent)
@@ -155,11 +411,17 @@ Prefetcher::Worker::~Worker() { }
 void
 Prefetcher::Worker::run()
 {
+    QVector<ImageFile> batch;
+    Job job;
     for (;;)
     {
-        ImageFile *f = master->getTask();
-        QByteArray *data = f->readData();
-        master->setResult(f->createKey(), data);
+        if (master->getTask(batch, job))
+        {
+            master->storeData(job.file, job.data);
+        }
+        else
+        {
+            master->fetch(batch);
+        }
     }
 }
-
@@ -3,11 +3,14 @@
 
 #include <QThread>
 #include <QVector>
+#include <QList>
 #include <QByteArray>
 #include <QCache>
+#include <QImage>
 #include <QMutex>
 #include <QWaitCondition>
 #include "ImageFile.hpp"
+#include "PackedImage.hpp"
 
 class Prefetcher : public QThread
 {
@@ -16,9 +19,19 @@ public:
     ~Prefetcher();
 
     void putRequest(const QVector<ImageFile> &args);
-    QByteArray *get(const QString &key);
+    bool get(const QString &key, ImageFile::Data &data);
+    // PAGEはファイル全体を持たずにデコードした画像をキャッシュする．
+    // 圧縮して持っている画像もここで展開して返す
+    bool getImage(const QString &key, QImage &img);
+    // 変更されたファイルのキャッシュを捨てる
+    void remove(const QString &key);
     void setCacheSize(int n);
     int getCacheSize() const;
+    // デコードした画像を圧縮して持つキャッシュの大きさ(MiB)．
+    // 0なら使わずにファイルの内容を持つ
+    void setPackedCacheSize(int mib);
+    int getPackedCacheSize() const;
+    void setDecodeOptions(int options);
 
 protected:
     void run();
@@ -35,10 +48,22 @@ private:
         Prefetcher *master;
     };
     
+    // 書庫からまとめて取り出したファイルのデコードを他のワーカーに任せる
+    struct Job
+    {
+        ImageFile file;
+        ImageFile::Data data;
+    };
+
     Worker *worker[8];
-    QCache<QString, QByteArray> cache;
+    QCache<QString, ImageFile::Data> cache;
+    QCache<QString, QImage> img_cache;
+    QCache<QString, PackedImage> packed_cache; // コストはKiB
+    int decode_opts;
     QVector<ImageFile> files;
+    QVector<bool> taken;    // 他のファイルとまとめて取り出し済みか
     QVector<ImageFile> reqfiles;
+    QList<Job> jobs;
 
     QMutex mutex;
     QMutex mutex_req;
@@ -48,8 +73,16 @@ private:
     int task_no;
     int task_filled;
 
-    ImageFile *getTask();
-    void setResult(const QString &key, QByteArray *data);
+    bool getTask(QVector<ImageFile> &batch, Job &job);
+    void putJob(const ImageFile &f, const ImageFile::Data &data);
+    void fetch(const QVector<ImageFile> &batch);
+    void storeData(const ImageFile &f, const ImageFile::Data &data);
+    void setResult(const QString &key, const ImageFile::Data &data);
+    void setImageResult(const QString &key, QImage *img);
+    void setPackedResult(const QString &key, PackedImage *img);
+    bool isPacking(int &options);
+    bool isCached(const QString &key);
+    void taskFilled();
 };
 
 #endif // PREFETCHER_HPP
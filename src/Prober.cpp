@@ -0,0 +1,169 @@
+#include <QFile>
+#include "Prober.hpp"
+#include "Decoder.hpp"
+#include "TiffPages.hpp"
+
+Prober::Prober(QObject *parent)
+    : QThread(parent)
+    , reqfiles()
+    , quit(false)
+{
+    start();
+}
+
+Prober::~Prober()
+{
+    mutex.lock();
+    quit = true;
+    reqfiles.clear();
+    cond_req.wakeOne();
+    mutex.unlock();
+    wait();
+}
+
+void
+Prober::putRequest(const QVector<ImageFile> &tasks)
+{
+    mutex.lock();
+    reqfiles << tasks;
+    cond_req.wakeOne();
+    mutex.unlock();
+}
+
+void
+Prober::clear()
+{
+    mutex.lock();
+    reqfiles.clear();
+    mutex.unlock();
+}
+
+void
+Prober::run()
+{
+    for (;;)
+    {
+        mutex.lock();
+        while (reqfiles.empty() && !quit)
+        {
+            cond_req.wait(&mutex);
+        }
+        if (quit)
+        {
+            mutex.unlock();
+            return;
+        }
+
+        // 同じ書庫のエントリはまとめて一度の走査で読む
+        QVector<ImageFile> batch;
+        batch << reqfiles.takeFirst();
+        if (batch[0].fileType() == ImageFile::ARCHIVE)
+        {
+            while (!reqfiles.empty() && reqfiles[0].isSameArchive(batch[0]))
+            {
+                batch << reqfiles.takeFirst();
+            }
+        }
+        mutex.unlock();
+
+        const QFileInfo info(batch[0].physicalFilePath());
+        probeCached(info, batch);
+        if (batch.empty()) continue;
+
+        QVector<Catalog::Page> pages;
+        if (batch[0].fileType() == ImageFile::ARCHIVE)
+        {
+            probeArchive(batch, pages);
+        }
+        else
+        {
+            probeFile(batch[0], pages);
+        }
+        Catalog::storePages(info, pages);
+    }
+}
+
+// 前に調べたページは読まずに知らせてfilesから取り除く
+void
+Prober::probeCached(const QFileInfo &info, QVector<ImageFile> &files)
+{
+    QVector<Catalog::Page> pages;
+    if (!Catalog::findPages(info, pages)) return;
+
+    QHash<QString, int> keys;
+    for (int i = 0; i < pages.count(); ++i)
+    {
+        keys.insert(pages[i].key, i);
+    }
+    for (int i = 0; i < files.count(); )
+    {
+        auto iter = keys.constFind(files[i].createKey());
+        if (iter == keys.constEnd())
+        {
+            ++i;
+            continue;
+        }
+        const Catalog::Page &p = pages[iter.value()];
+        emit probed(p.key, p.size, p.format, p.bytes);
+        files.remove(i);
+    }
+}
+
+void
+Prober::probeFile(const ImageFile &f, QVector<Catalog::Page> &pages)
+{
+    if (f.fileType() == ImageFile::PAGE)
+    {
+        // ページ単位のバイト数は分からないので0にしておく
+        QSize size;
+        if (TiffPages::probe(f.physicalFilePath(), f.pageOffset(), size))
+        {
+            const Catalog::Page p = {f.createKey(), size, f.format(), 0};
+            pages << p;
+            emit probed(p.key, p.size, p.format, p.bytes);
+        }
+        return;
+    }
+
+    QFile file(f.physicalFilePath());
+    if (!file.open(QIODevice::ReadOnly)) return;
+    probeData(f, file.read(header_size), file.size(), pages);
+}
+
+void
+Prober::probeArchive(const QVector<ImageFile> &files,
+        QVector<Catalog::Page> &pages)
+{
+    QVector<QByteArray> heads;
+    QVector<qint64> sizes;
+    if (!ImageFile::readArchiveHeads(files, header_size, heads, sizes))
+    {
+        return;
+    }
+
+    for (int i = 0; i < files.count(); ++i)
+    {
+        probeData(files[i], heads[i], sizes[i], pages);
+    }
+}
+
+void
+Prober::probeData(const ImageFile &f, const QByteArray &head,
+        qint64 bytes, QVector<Catalog::Page> &pages)
+{
+    if (head.isEmpty()) return;
+
+    QByteArray fmt = f.format();
+    if (fmt.isEmpty())
+    {
+        fmt = Decoder::detectFormat(head.constData(), head.size());
+    }
+
+    QSize size;
+    if (Decoder::probe(head, fmt, size))
+    {
+        const Catalog::Page p = {f.createKey(), size, fmt, bytes};
+        pages << p;
+        emit probed(p.key, p.size, p.format, p.bytes);
+    }
+}
@@ -0,0 +1,50 @@
+#ifndef PROBER_HPP
+#define PROBER_HPP
+
+#include <QThread>
+#include <QVector>
+#include <QByteArray>
+#include <QString>
+#include <QSize>
+#include <QMutex>
+#include <QWaitCondition>
+#include "ImageFile.hpp"
+#include "Catalog.hpp"
+
+// 画像のヘッダだけを読み，寸法とフォーマットを調べる．
+// 調べた結果はCatalogに保存し，変わっていないファイルは読まない
+class Prober : public QThread
+{
+    Q_OBJECT
+public:
+    explicit Prober(QObject *parent = 0);
+    ~Prober();
+
+    void putRequest(const QVector<ImageFile> &args);
+    void clear();
+
+signals:
+    void probed(const QString &key, const QSize &size,
+            const QByteArray &format, qint64 bytes);
+
+protected:
+    void run();
+
+private:
+    QVector<ImageFile> reqfiles;
+    QMutex mutex;
+    QWaitCondition cond_req;
+    bool quit;
+
+    // 画像の先頭からこのバイト数だけ読んでヘッダを解析する
+    static const qint64 header_size = 128*1024;
+
+    void probeCached(const QFileInfo &info, QVector<ImageFile> &files);
+    void probeFile(const ImageFile &f, QVector<Catalog::Page> &pages);
+    void probeArchive(const QVector<ImageFile> &files,
+            QVector<Catalog::Page> &pages);
+    void probeData(const ImageFile &f, const QByteArray &head,
+            qint64 bytes, QVector<Catalog::Page> &pages);
+};
+
+#endif // PROBER_HPP
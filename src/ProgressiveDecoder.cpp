@@ -0,0 +1,441 @@
+#include <QBuffer>
+#include <QImageReader>
+#include <algorithm>
+#include "ProgressiveDecoder.hpp"
+#include "JpegDecoder.hpp"
+#include "Decoder.hpp"
+
+#ifdef USE_LIBJPEG_TURBO
+#include <cstdio>
+#include <csetjmp>
+#include <jpeglib.h>
+
+struct ProgressiveDecoder::JpegState
+{
+    enum Stage { Header, Start, Output, Done };
+
+    struct Error
+    {
+        struct jpeg_error_mgr pub;
+        jmp_buf jmp;
+    };
+
+    jpeg_decompress_struct cinfo;
+    Error err;
+    jpeg_source_mgr src;
+    qint64 fed;         // これまでに渡したデータの終わり
+    qint64 skip;        // 届いていないが読み飛ばす分
+    Stage stage;
+    bool outputting;    // 出力パスの途中で中断しているか
+    int done_scan;      // 届き終わったスキャン
+    int shown_scan;     // 画像に書き出したスキャン
+    QImage img;
+    bool failed;
+};
+
+static void
+jpeg_state_error_exit(j_common_ptr cinfo)
+{
+    ProgressiveDecoder::JpegState::Error *err =
+        reinterpret_cast<ProgressiveDecoder::JpegState::Error*>(cinfo->err);
+    longjmp(err->jmp, 1);
+}
+
+static void
+jpeg_state_output_message(j_common_ptr cinfo)
+{
+    Q_UNUSED(cinfo);
+}
+
+static void
+jpeg_src_init(j_decompress_ptr cinfo)
+{
+    Q_UNUSED(cinfo);
+}
+
+// 続きはまだ届いていないので中断させる
+static boolean
+jpeg_src_fill(j_decompress_ptr cinfo)
+{
+    Q_UNUSED(cinfo);
+    return FALSE;
+}
+
+static void
+jpeg_src_skip(j_decompress_ptr cinfo, long n)
+{
+    if (n <= 0) return;
+    ProgressiveDecoder::JpegState *st =
+        static_cast<ProgressiveDecoder::JpegState*>(cinfo->client_data);
+    jpeg_source_mgr *src = cinfo->src;
+    if (size_t(n) <= src->bytes_in_buffer)
+    {
+        src->next_input_byte += n;
+        src->bytes_in_buffer -= n;
+        return;
+    }
+    // 届いていない分は次に渡すときに飛ばす
+    st->skip += n - src->bytes_in_buffer;
+    src->next_input_byte += src->bytes_in_buffer;
+    src->bytes_in_buffer = 0;
+}
+
+static void
+jpeg_src_term(j_decompress_ptr cinfo)
+{
+    Q_UNUSED(cinfo);
+}
+
+// 出力パスの残りの行を画像に書き込む．全部書けたらtrue
+static bool
+jpeg_state_read_rows(ProgressiveDecoder::JpegState *st)
+{
+    jpeg_decompress_struct &cinfo = st->cinfo;
+    while (cinfo.output_scanline < cinfo.output_height)
+    {
+        JSAMPROW rows[16];
+        const JDIMENSION y = cinfo.output_scanline;
+        const int n = std::min<JDIMENSION>(16, cinfo.output_height - y);
+        // 途中経過を渡した後はscanLineで複製されるので毎回取り直す
+        for (int i = 0; i < n; ++i)
+        {
+            rows[i] = st->img.scanLine(y + i);
+        }
+        if (jpeg_read_scanlines(&cinfo, rows, n) == 0) return false;
+    }
+    return true;
+}
+#else
+struct ProgressiveDecoder::JpegState
+{
+};
+#endif
+
+#ifdef USE_LIBPNG
+#include <csetjmp>
+#include <png.h>
+
+struct ProgressiveDecoder::PngState
+{
+    png_structp png;
+    png_infop info;
+    QImage img;        // 途中経過を書き込む画像
+    qint64 consumed;   // libpngに渡したバイト数
+    bool failed;
+};
+
+static void
+png_info_callback(png_structp png, png_infop info)
+{
+    ProgressiveDecoder::PngState *st =
+        static_cast<ProgressiveDecoder::PngState*>(
+                png_get_progressive_ptr(png));
+
+    png_uint_32 w, h;
+    int depth, color;
+    png_get_IHDR(png, info, &w, &h, &depth, &color,
+            nullptr, nullptr, nullptr);
+
+    // どの形式も8bitのARGB32に揃える
+    if (color == PNG_COLOR_TYPE_PALETTE) png_set_palette_to_rgb(png);
+    if (color == PNG_COLOR_TYPE_GRAY && depth < 8)
+    {
+        png_set_expand_gray_1_2_4_to_8(png);
+    }
+    if (png_get_valid(png, info, PNG_INFO_tRNS)) png_set_tRNS_to_alpha(png);
+    if (depth == 16) png_set_strip_16(png);
+    if (color == PNG_COLOR_TYPE_GRAY ||
+            color == PNG_COLOR_TYPE_GRAY_ALPHA)
+    {
+        png_set_gray_to_rgb(png);
+    }
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+    png_set_bgr(png);
+    png_set_filler(png, 0xFF, PNG_FILLER_AFTER);
+#else
+    png_set_swap_alpha(png);
+    png_set_filler(png, 0xFF, PNG_FILLER_BEFORE);
+#endif
+    // インターレースは各パスの画素を矩形に引き伸ばして合成させる
+    png_set_interlace_handling(png);
+    png_read_update_info(png, info);
+
+    st->img = QImage(w, h, QImage::Format_ARGB32);
+    if (st->img.isNull()) png_error(png, "out of memory");
+    st->img.fill(0);
+}
+
+static void
+png_row_callback(png_structp png, png_bytep row,
+        png_uint_32 row_num, int pass)
+{
+    Q_UNUSED(pass);
+    if (!row) return;
+
+    ProgressiveDecoder::PngState *st =
+        static_cast<ProgressiveDecoder::PngState*>(
+                png_get_progressive_ptr(png));
+    // 途中経過を渡した後はscanLineで複製されるので毎回取り直す
+    png_progressive_combine_row(png, st->img.scanLine(row_num), row);
+}
+
+static void
+png_end_callback(png_structp png, png_infop info)
+{
+    Q_UNUSED(png);
+    Q_UNUSED(info);
+}
+#else
+struct ProgressiveDecoder::PngState
+{
+};
+#endif
+
+ProgressiveDecoder::ProgressiveDecoder(const QByteArray &format,
+        int options)
+    : fmt(format)
+    , opts(options)
+    , png(nullptr)
+    , jpeg(nullptr)
+{
+}
+
+ProgressiveDecoder::~ProgressiveDecoder()
+{
+#ifdef USE_LIBPNG
+    if (png)
+    {
+        png_destroy_read_struct(&png->png, &png->info, nullptr);
+    }
+#endif
+    delete png;
+#ifdef USE_LIBJPEG_TURBO
+    if (jpeg) jpeg_destroy_decompress(&jpeg->cinfo);
+#endif
+    delete jpeg;
+}
+
+bool
+ProgressiveDecoder::isSupported() const
+{
+    if (fmt == "jpeg") return true;
+#ifdef USE_LIBPNG
+    if (fmt == "png") return true;
+#endif
+    return false;
+}
+
+bool
+ProgressiveDecoder::update(const QByteArray &data, QImage &img)
+{
+    if (fmt == "jpeg") return updateJpeg(data, img);
+    if (fmt == "png")  return updatePng(data, img);
+    return false;
+}
+
+bool
+ProgressiveDecoder::updateJpeg(const QByteArray &data, QImage &img)
+{
+#ifdef USE_LIBJPEG_TURBO
+    if (!jpeg)
+    {
+        jpeg = new JpegState();
+        jpeg->cinfo.err = jpeg_std_error(&jpeg->err.pub);
+        jpeg->err.pub.error_exit = jpeg_state_error_exit;
+        jpeg->err.pub.output_message = jpeg_state_output_message;
+        jpeg->fed = 0;
+        jpeg->skip = 0;
+        jpeg->stage = JpegState::Header;
+        jpeg->outputting = false;
+        jpeg->done_scan = 0;
+        jpeg->shown_scan = 0;
+        jpeg->failed = false;
+        if (setjmp(jpeg->err.jmp))
+        {
+            jpeg->failed = true;
+            return false;
+        }
+        jpeg_create_decompress(&jpeg->cinfo);
+        jpeg->cinfo.client_data = jpeg;
+        jpeg->src.next_input_byte = nullptr;
+        jpeg->src.bytes_in_buffer = 0;
+        jpeg->src.init_source = jpeg_src_init;
+        jpeg->src.fill_input_buffer = jpeg_src_fill;
+        jpeg->src.skip_input_data = jpeg_src_skip;
+        jpeg->src.resync_to_restart = jpeg_resync_to_restart;
+        jpeg->src.term_source = jpeg_src_term;
+        jpeg->cinfo.src = &jpeg->src;
+    }
+    if (jpeg->failed) return false;
+    if (jpeg->stage == JpegState::Done)
+    {
+        img = jpeg->img;
+        return true;
+    }
+
+    // バッファは伸びるときに移ることがあるので，読んだ位置から渡し直す
+    qint64 pos = jpeg->fed - jpeg->src.bytes_in_buffer + jpeg->skip;
+    jpeg->skip = std::max<qint64>(0, pos - data.size());
+    pos = std::min<qint64>(pos, data.size());
+    jpeg->src.next_input_byte =
+        reinterpret_cast<const JOCTET*>(data.constData()) + pos;
+    jpeg->src.bytes_in_buffer = data.size() - pos;
+    jpeg->fed = data.size();
+
+    jpeg_decompress_struct &cinfo = jpeg->cinfo;
+    if (setjmp(jpeg->err.jmp))
+    {
+        jpeg->failed = true;
+        return false;
+    }
+
+    if (jpeg->stage == JpegState::Header)
+    {
+        const int r = jpeg_read_header(&cinfo, TRUE);
+        if (r == JPEG_SUSPENDED) return false;
+        if (r != JPEG_HEADER_OK || cinfo.jpeg_color_space == JCS_CMYK ||
+                cinfo.jpeg_color_space == JCS_YCCK)
+        {
+            // CMYKは読み終えてからQtのプラグインに任せる
+            jpeg->failed = true;
+            return false;
+        }
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+        cinfo.out_color_space = JCS_EXT_BGRX;
+#else
+        cinfo.out_color_space = JCS_EXT_XRGB;
+#endif
+        cinfo.dct_method = (opts & JpegDecoder::FastIDCT)
+            ? JDCT_IFAST : JDCT_ISLOW;
+        cinfo.do_fancy_upsampling = (opts & JpegDecoder::FastUpsampling)
+            ? FALSE : TRUE;
+        // 平滑化は次のスキャンを先読みしようとして中断するので使わない
+        cinfo.do_block_smoothing = FALSE;
+        // プログレッシブはスキャンを溜めておき，届き終わるごとに書き出す
+        cinfo.buffered_image = jpeg_has_multiple_scans(&cinfo);
+        jpeg->stage = JpegState::Start;
+    }
+
+    if (jpeg->stage == JpegState::Start)
+    {
+        if (!jpeg_start_decompress(&cinfo)) return false;
+        jpeg->img = QImage(cinfo.output_width, cinfo.output_height,
+                QImage::Format_RGB32);
+        if (jpeg->img.isNull())
+        {
+            jpeg->failed = true;
+            return false;
+        }
+        jpeg->img.fill(Qt::darkGray);
+        jpeg->stage = JpegState::Output;
+    }
+
+    if (!cinfo.buffered_image)
+    {
+        // ベースラインは届いた行まで上から埋める
+        if (jpeg_state_read_rows(jpeg))
+        {
+            jpeg_finish_decompress(&cinfo);
+            jpeg->stage = JpegState::Done;
+        }
+        if (cinfo.output_scanline == 0) return false;
+        img = jpeg->img;
+        return true;
+    }
+
+    for (;;)
+    {
+        if (!jpeg->outputting)
+        {
+            int r;
+            do
+            {
+                r = jpeg_consume_input(&cinfo);
+                if (r == JPEG_SCAN_COMPLETED || r == JPEG_REACHED_EOI)
+                {
+                    jpeg->done_scan = cinfo.input_scan_number;
+                }
+            } while (r != JPEG_SUSPENDED && r != JPEG_REACHED_EOI);
+            if (jpeg->done_scan <= jpeg->shown_scan) break;
+            jpeg_start_output(&cinfo, jpeg->done_scan);
+            jpeg->outputting = true;
+        }
+        if (!jpeg_state_read_rows(jpeg) || !jpeg_finish_output(&cinfo))
+        {
+            break;
+        }
+        jpeg->outputting = false;
+        jpeg->shown_scan = cinfo.output_scan_number;
+        if (jpeg_input_complete(&cinfo) &&
+                jpeg->shown_scan >= cinfo.input_scan_number)
+        {
+            jpeg_finish_decompress(&cinfo);
+            jpeg->stage = JpegState::Done;
+            break;
+        }
+    }
+    if (jpeg->shown_scan == 0) return false;
+    img = jpeg->img;
+    return true;
+#else
+    // 毎回デコードし直すので，縮小して読み込みを止める時間を抑える
+    QBuffer buf;
+    buf.setData(data);
+    buf.open(QIODevice::ReadOnly);
+    QImageReader reader(&buf, "jpeg");
+    const QSize size = reader.size();
+    if (size.isValid())
+    {
+        reader.setScaledSize(QSize(
+                    std::max(1, size.width() / fallback_denom),
+                    std::max(1, size.height() / fallback_denom)));
+    }
+    QImage out;
+    if (!reader.read(&out)) return false;
+    img = Decoder::toDisplayFormat(out);
+    return true;
+#endif
+}
+
+bool
+ProgressiveDecoder::updatePng(const QByteArray &data, QImage &img)
+{
+#ifdef USE_LIBPNG
+    if (!png)
+    {
+        png = new PngState();
+        png->png = png_create_read_struct(PNG_LIBPNG_VER_STRING,
+                nullptr, nullptr, nullptr);
+        png->info = png->png ? png_create_info_struct(png->png) : nullptr;
+        png->consumed = 0;
+        png->failed = (png->info == nullptr);
+        if (!png->failed)
+        {
+            png_set_progressive_read_fn(png->png, png, png_info_callback,
+                    png_row_callback, png_end_callback);
+        }
+    }
+    if (png->failed) return false;
+
+    if (setjmp(png_jmpbuf(png->png)))
+    {
+        png->failed = true;
+        return false;
+    }
+
+    const qint64 len = data.size() - png->consumed;
+    if (len > 0)
+    {
+        png_process_data(png->png, png->info,
+                (png_bytep)data.constData() + png->consumed, len);
+        png->consumed = data.size();
+    }
+    if (png->img.isNull()) return false;
+    img = png->img;
+    return true;
+#else
+    Q_UNUSED(data);
+    Q_UNUSED(img);
+    return false;
+#endif
+}
@@ -0,0 +1,45 @@
+#ifndef PROGRESSIVEDECODER_HPP
+#define PROGRESSIVEDECODER_HPP
+
+#include <QByteArray>
+#include <QImage>
+
+// 読み込み途中のデータから途中経過の画像を作る．
+// JPEGはlibjpegを中断できるソースで動かして届いた分だけを処理する
+// (プログレッシブは届き終わったスキャンごとに鮮明になり，
+// ベースラインは上から埋まる)．libjpeg-turboが無ければ
+// 届いた分を縮小してデコードし直す．
+// PNGはlibpngの逐次読み込みで届いた分だけを処理する
+class ProgressiveDecoder
+{
+public:
+    // optionsはJpegDecoder::Optionの組み合わせ
+    explicit ProgressiveDecoder(const QByteArray &format, int options = 0);
+    ~ProgressiveDecoder();
+
+    bool isSupported() const;
+
+    // dataには先頭からこれまでに届いたデータ全体を渡す
+    bool update(const QByteArray &data, QImage &img);
+
+    struct PngState; // libpngのコールバックから参照する
+    struct JpegState; // libjpegのコールバックから参照する
+
+private:
+
+    QByteArray fmt;
+    int opts;
+    PngState *png;
+    JpegState *jpeg;
+
+    // libjpeg-turboが無いときに途中経過をデコードする縮小率
+    static const int fallback_denom = 4;
+
+    bool updateJpeg(const QByteArray &data, QImage &img);
+    bool updatePng(const QByteArray &data, QImage &img);
+
+    ProgressiveDecoder(const ProgressiveDecoder &) = delete;
+    ProgressiveDecoder &operator=(const ProgressiveDecoder &) = delete;
+};
+
+#endif // PROGRESSIVEDECODER_HPP
@@ -1,6 +1,7 @@
 #include "SettingDialog.hpp"
 #include "App.hpp"
 #include "Viewer.hpp"
+#include "PackedImage.hpp"
 
 SettingDialog::SettingDialog(QWidget *parent)
     : QDialog(parent,
@@ -14,14 +15,22 @@ SettingDialog::SettingDialog(QWidget *parent)
     , open_rec_layout(new QGridLayout())
     , open_rec_dir_level_text(new QLabel(tr("サブディレクトリの深さ")))
     , open_rec_dir_level(new QSpinBox())
+    , open_threads_text(new QLabel(tr("同時に読むディレクトリの数")))
+    , open_threads(new QSpinBox())
+    , open_watch(new QCheckBox(tr("開いたディレクトリの変更を反映する")))
     , group_Prefetch(new QGroupBox(tr("画像ファイルのプリフェッチ"), this))
     , prefetch_layout(new QGridLayout())
     , prefetch_text(new QLabel(tr("画像ファイル数")))
     , prefetch_value(new QSpinBox())
+    , packed_text(new QLabel(tr("展開済みの画像(MiB)")))
+    , packed_value(new QSpinBox())
     , group_FeedPage(new QGroupBox(tr("ページのめくり方"), this))
     , feedpage_layout(new QGridLayout())
     , feedpage_clckbtn(new QRadioButton(tr("左/右クリックで進む/戻る")))
     , feedpage_clckpos(new QRadioButton(tr("クリック位置で進む/戻る")))
+    , group_Decode(new QGroupBox(tr("画像のデコード"), this))
+    , decode_layout(new QGridLayout())
+    , decode_fast(new QCheckBox(tr("JPEGを高速にデコードする(画質は低下)")))
 {
     setWindowTitle(tr("Configuration"));
     setLayout(layout);
@@ -30,20 +39,34 @@ SettingDialog::SettingDialog(QWidget *parent)
     open_rec_dir_level->setRange(0, 100);
     open_rec_layout->addWidget(open_rec_dir_level_text, 0, 0, 1, 1);
     open_rec_layout->addWidget(open_rec_dir_level,      0, 1, 1, 1);
+    open_threads->setRange(1, 64);
+    open_rec_layout->addWidget(open_threads_text, 1, 0, 1, 1);
+    open_rec_layout->addWidget(open_threads,      1, 1, 1, 1);
+    open_rec_layout->addWidget(open_watch,        2, 0, 1, 2);
 
     group_Prefetch->setLayout(prefetch_layout);
     prefetch_value->setRange(0, 1000);
     prefetch_value->setSingleStep(1);
     prefetch_layout->addWidget(prefetch_text,  0, 0, 1, 1);
     prefetch_layout->addWidget(prefetch_value, 0, 1, 1, 1);
+    // 0なら画像ファイルの内容をそのまま持つ
+    packed_value->setRange(0, 16384);
+    packed_value->setSingleStep(64);
+    packed_value->setEnabled(PackedImage::isAvailable());
+    prefetch_layout->addWidget(packed_text,  1, 0, 1, 1);
+    prefetch_layout->addWidget(packed_value, 1, 1, 1, 1);
 
     group_FeedPage->setLayout(feedpage_layout);
     feedpage_layout->addWidget(feedpage_clckbtn, 0, 0, 1, 1);
     feedpage_layout->addWidget(feedpage_clckpos, 1, 0, 1, 1);
 
+    group_Decode->setLayout(decode_layout);
+    decode_layout->addWidget(decode_fast, 0, 0, 1, 1);
+
     layout->addWidget(group_OpenDir);
     layout->addWidget(group_Prefetch);
     layout->addWidget(group_FeedPage);
+    layout->addWidget(group_Decode);
     layout->addWidget(buttonbox);
 
     connect(buttonbox, SIGNAL(accepted()), this, SLOT(accept()));
@@ -56,11 +79,16 @@ SettingDialog::~SettingDialog()
 {
     delete open_rec_dir_level_text;
     delete open_rec_dir_level;
+    delete open_threads_text;
+    delete open_threads;
+    delete open_watch;
     delete open_rec_layout;
     delete group_OpenDir;
 
     delete prefetch_text;
     delete prefetch_value;
+    delete packed_text;
+    delete packed_value;
     delete prefetch_layout;
     delete group_Prefetch;
 
@@ -69,6 +97,10 @@ SettingDialog::~SettingDialog()
     delete feedpage_layout;
     delete group_FeedPage;
 
+    delete decode_fast;
+    delete decode_layout;
+    delete group_Decode;
+
     delete buttonbox;
     delete layout;
 }
@@ -91,18 +123,25 @@ void
 SettingDialog::loadSettings()
 {
     open_rec_dir_level->setValue(App::view_openlevel);
+    open_threads->setValue(App::view_openthreads);
+    open_watch->setChecked(App::view_watchdirs);
     prefetch_value->setValue(App::pl_prefetch);
+    packed_value->setValue(App::pl_packedcache);
     feedpage_clckbtn->setChecked(App::view_feedpage
         == Viewer::MouseButton);
     feedpage_clckpos->setChecked(App::view_feedpage
             == Viewer::MouseClickPosition);
+    decode_fast->setChecked(App::view_fastdecode);
 }
 
 void
 SettingDialog::saveSettings()
 {
     App::view_openlevel = open_rec_dir_level->value();
+    App::view_openthreads = open_threads->value();
+    App::view_watchdirs = open_watch->isChecked();
     App::pl_prefetch = prefetch_value->value();
+    App::pl_packedcache = packed_value->value();
     if (feedpage_clckbtn->isChecked())
     {
         App::view_feedpage = Viewer::MouseButton;
@@ -111,5 +150,6 @@ SettingDialog::saveSettings()
     {
         App::view_feedpage = Viewer::MouseClickPosition;
     }
+    App::view_fastdecode = decode_fast->isChecked();
 }
 
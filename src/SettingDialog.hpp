@@ -29,17 +29,26 @@ private:
     QGridLayout *open_rec_layout;
     QLabel      *open_rec_dir_level_text;
     QSpinBox    *open_rec_dir_level;
+    QLabel      *open_threads_text;
+    QSpinBox    *open_threads;
+    QCheckBox   *open_watch;
 
     QGroupBox   *group_Prefetch;
     QGridLayout *prefetch_layout;
     QLabel      *prefetch_text;
     QSpinBox    *prefetch_value;
+    QLabel      *packed_text;
+    QSpinBox    *packed_value;
 
     QGroupBox    *group_FeedPage;
     QGridLayout  *feedpage_layout;
     QRadioButton *feedpage_clckbtn;
     QRadioButton *feedpage_clckpos;
 
+    QGroupBox   *group_Decode;
+    QGridLayout *decode_layout;
+    QCheckBox   *decode_fast;
+
     void loadSettings();
     void saveSettings();
 };
@@ -1,4 +1,4 @@
-QT += core gui
+QT += core gui sql
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
@@ -11,12 +11,30 @@ MainWindow.cpp \
 App.cpp \
 Viewer.cpp \
 ImageFile.cpp \
+ArchiveIndex.cpp \
+Catalog.cpp \
+ZipReader.cpp \
+GzipIndex.cpp \
+TiffPages.cpp \
 PlaylistModel.cpp \
 ImageViewer.cpp \
 image.cpp \
 ScaleDialog.cpp \
 SettingDialog.cpp \
-Prefetcher.cpp
+Prefetcher.cpp \
+PackedImage.cpp \
+Prober.cpp \
+FileLister.cpp \
+PageLoader.cpp \
+StreamDevice.cpp \
+AnimationDecoder.cpp \
+AnimationPlayer.cpp \
+Decoder.cpp \
+ProgressiveDecoder.cpp \
+JpegDecoder.cpp \
+WebpDecoder.cpp \
+AvifDecoder.cpp \
+JpegXLDecoder.cpp
 
 HEADERS += \
 for_windows_env.hpp \
@@ -24,12 +42,30 @@ MainWindow.hpp \
 App.hpp \
 Viewer.hpp \
 ImageFile.hpp \
+ArchiveIndex.hpp \
+Catalog.hpp \
+ZipReader.hpp \
+GzipIndex.hpp \
+TiffPages.hpp \
 PlaylistModel.hpp \
 ImageViewer.hpp \
 image.hpp \
 ScaleDialog.hpp \
 SettingDialog.hpp \
-Prefetcher.hpp
+Prefetcher.hpp \
+PackedImage.hpp \
+Prober.hpp \
+FileLister.hpp \
+PageLoader.hpp \
+StreamDevice.hpp \
+AnimationDecoder.hpp \
+AnimationPlayer.hpp \
+Decoder.hpp \
+ProgressiveDecoder.hpp \
+JpegDecoder.hpp \
+WebpDecoder.hpp \
+AvifDecoder.hpp \
+JpegXLDecoder.hpp
 
 FORMS +=
 
@@ -38,12 +74,57 @@ FORMS +=
 USE_CUSTOM_FONT = 1
 
 equals(USE_CUSTOM_FONT,1) {
-DEFINES = USE_CUSTOM_FONT
+DEFINES += USE_CUSTOM_FONT
 RESOURCES += rc/font.qrc
 }
 
+# Optional libraries are off by default. Enable the installed ones on
+# the command line, e.g. "qmake USE_LIBJPEG_TURBO=1".
+
+# JPEG is decoded with libjpeg-turbo directly instead of Qt's plugin.
+isEmpty(USE_LIBJPEG_TURBO): USE_LIBJPEG_TURBO = 0
+
+equals(USE_LIBJPEG_TURBO,1) {
+DEFINES += USE_LIBJPEG_TURBO
+LIBS += -ljpeg
+}
+
+# PNG is read with libpng's progressive reader to show pages while loading.
+isEmpty(USE_LIBPNG): USE_LIBPNG = 0
+
+equals(USE_LIBPNG,1) {
+DEFINES += USE_LIBPNG
+LIBS += -lpng
+}
+
+# Prefetched pages are kept decoded and LZ4-compressed.
+isEmpty(USE_LZ4): USE_LZ4 = 0
+
+equals(USE_LZ4,1) {
+DEFINES += USE_LZ4
+LIBS += -llz4
+}
+
+# Decoders for newer formats.
+isEmpty(USE_LIBWEBP): USE_LIBWEBP = 0
+isEmpty(USE_LIBAVIF): USE_LIBAVIF = 0
+isEmpty(USE_LIBJXL):  USE_LIBJXL  = 0
+
+equals(USE_LIBWEBP,1) {
+DEFINES += USE_LIBWEBP
+LIBS += -lwebp
+}
+equals(USE_LIBAVIF,1) {
+DEFINES += USE_LIBAVIF
+LIBS += -lavif
+}
+equals(USE_LIBJXL,1) {
+DEFINES += USE_LIBJXL
+LIBS += -ljxl -ljxl_threads
+}
+
 INCLUDEPATH +=
-LIBS += -larchive
+LIBS += -larchive -lz
 
 win32-msvc* {
 QMAKE_CXXFLAGS += -std:c++11
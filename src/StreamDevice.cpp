@@ -0,0 +1,86 @@
+#include <QMutexLocker>
+#include <algorithm>
+#include <cstring>
+#include "StreamDevice.hpp"
+
+StreamDevice::StreamDevice(qint64 size, QObject *parent)
+    : QIODevice(parent)
+    , buf()
+    , total(size)
+    , read_pos(0)
+    , finished(false)
+{
+    // 展開しながら領域を広げ直さないように先に確保しておく
+    buf.reserve(size);
+}
+
+StreamDevice::~StreamDevice()
+{
+}
+
+bool
+StreamDevice::isSequential() const
+{
+    return false;
+}
+
+qint64
+StreamDevice::size() const
+{
+    return total;
+}
+
+bool
+StreamDevice::seek(qint64 pos)
+{
+    QIODevice::seek(pos);
+    QMutexLocker locker(&mutex);
+    read_pos = pos;
+    return 0 <= pos && pos <= total;
+}
+
+void
+StreamDevice::append(const char *data, qint64 len)
+{
+    QMutexLocker locker(&mutex);
+    buf.append(data, std::min(len, total - buf.size()));
+    cond.wakeAll();
+}
+
+void
+StreamDevice::finish()
+{
+    QMutexLocker locker(&mutex);
+    finished = true;
+    cond.wakeAll();
+}
+
+QByteArray
+StreamDevice::data() const
+{
+    QMutexLocker locker(&mutex);
+    return buf;
+}
+
+qint64
+StreamDevice::readData(char *data, qint64 maxlen)
+{
+    QMutexLocker locker(&mutex);
+    while (!finished && buf.size() <= read_pos && read_pos < total)
+    {
+        cond.wait(&mutex);
+    }
+    const qint64 n = std::min<qint64>(maxlen, buf.size() - read_pos);
+    if (n <= 0) return (finished && buf.size() < total) ? -1 : 0;
+    std::memcpy(data, buf.constData() + read_pos, n);
+    read_pos += n;
+    return n;
+}
+
+qint64
+StreamDevice::writeData(const char *data, qint64 len)
+{
+    Q_UNUSED(data);
+    Q_UNUSED(len);
+    return -1;
+}
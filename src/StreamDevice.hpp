@@ -0,0 +1,41 @@
+#ifndef STREAMDEVICE_HPP
+#define STREAMDEVICE_HPP
+
+#include <QIODevice>
+#include <QByteArray>
+#include <QMutex>
+#include <QWaitCondition>
+
+// 書庫から展開している途中のデータを読ませるデバイス．
+// 展開する側がappendで足していき，読む側はまだ届いていない位置を
+// 読もうとすると届くまで待つ．大きさは先に分かっていること
+class StreamDevice : public QIODevice
+{
+public:
+    explicit StreamDevice(qint64 size, QObject *parent = 0);
+    ~StreamDevice();
+
+    bool isSequential() const;
+    qint64 size() const;
+    bool seek(qint64 pos);
+
+    void append(const char *buf, qint64 len);
+    // 全部届いたか，途中で止めたときに呼ぶ
+    void finish();
+    // 届いたデータ．finishの後で使う
+    QByteArray data() const;
+
+protected:
+    qint64 readData(char *data, qint64 maxlen);
+    qint64 writeData(const char *data, qint64 len);
+
+private:
+    mutable QMutex mutex;
+    QWaitCondition cond;
+    QByteArray buf;
+    qint64 total;
+    qint64 read_pos;
+    bool finished;
+};
+
+#endif // STREAMDEVICE_HPP
@@ -0,0 +1,195 @@
+#include <QFile>
+#include <QIODevice>
+#include <QImageReader>
+#include <QSet>
+#include <cstring>
+#include "TiffPages.hpp"
+
+// ページ数の上限(壊れたファイルでの暴走を防ぐ)
+static const int max_pages = 65536;
+
+struct tiff_header
+{
+    bool le;        // リトルエンディアン
+    bool big;       // BigTIFF
+    qint64 first;   // 最初のIFDの位置
+};
+
+static quint64
+tiff_read(const uchar *p, int n, bool le)
+{
+    quint64 v = 0;
+    for (int i = 0; i < n; ++i)
+    {
+        v = (v << 8) | p[le ? n-1-i : i];
+    }
+    return v;
+}
+
+static bool
+read_header(QIODevice *dev, tiff_header &h)
+{
+    uchar buf[16];
+    if (!dev->seek(0) ||
+            dev->read(reinterpret_cast<char*>(buf), 16) < 8) return false;
+
+    if (memcmp(buf, "II", 2) == 0)      h.le = true;
+    else if (memcmp(buf, "MM", 2) == 0) h.le = false;
+    else return false;
+
+    switch (tiff_read(buf+2, 2, h.le))
+    {
+        case 42:
+            h.big = false;
+            h.first = tiff_read(buf+4, 4, h.le);
+            return true;
+        case 43:
+            h.big = true;
+            h.first = tiff_read(buf+8, 8, h.le);
+            return tiff_read(buf+4, 2, h.le) == 8;
+        default:
+            return false;
+    }
+}
+
+// 先頭のIFDの位置だけを書き換えて見せる．
+// 画像のデータはコピーせず元のデバイスから読む
+class TiffPageDevice : public QIODevice
+{
+public:
+    TiffPageDevice(QIODevice *dev, const tiff_header &h, qint64 ifd)
+        : QIODevice()
+        , device(dev)
+        , patch_pos(h.big ? 8 : 4)
+        , patch()
+    {
+        const int n = h.big ? 8 : 4;
+        for (int i = 0; i < n; ++i)
+        {
+            const int shift = 8 * (h.le ? i : n-1-i);
+            patch.append(char((quint64(ifd) >> shift) & 0xFF));
+        }
+    }
+
+    bool isSequential() const
+    {
+        return false;
+    }
+
+    qint64 size() const
+    {
+        return device->size();
+    }
+
+    bool seek(qint64 pos)
+    {
+        QIODevice::seek(pos);
+        return device->seek(pos);
+    }
+
+protected:
+    qint64 readData(char *data, qint64 maxlen)
+    {
+        const qint64 pos = device->pos();
+        const qint64 n = device->read(data, maxlen);
+        for (int i = 0; i < patch.size(); ++i)
+        {
+            const qint64 p = patch_pos + i - pos;
+            if (0 <= p && p < n) data[p] = patch[i];
+        }
+        return n;
+    }
+
+    qint64 writeData(const char *data, qint64 len)
+    {
+        Q_UNUSED(data);
+        Q_UNUSED(len);
+        return -1;
+    }
+
+private:
+    QIODevice *device;
+    qint64 patch_pos;
+    QByteArray patch;
+};
+
+QVector<qint64>
+TiffPages::index(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) return QVector<qint64>();
+    return index(&file);
+}
+
+QVector<qint64>
+TiffPages::index(QIODevice *dev)
+{
+    QVector<qint64> offsets;
+    tiff_header h;
+    if (!read_header(dev, h)) return offsets;
+
+    // エントリの中身は読まずに次のIFDへの位置だけをたどる
+    const int count_len = h.big ? 8 : 2;
+    const int entry_len = h.big ? 20 : 12;
+    const int next_len  = h.big ? 8 : 4;
+    QSet<qint64> seen;
+    qint64 off = h.first;
+    while (off > 0 && off < dev->size() && !seen.contains(off) &&
+            offsets.size() < max_pages)
+    {
+        seen.insert(off);
+        offsets << off;
+
+        uchar buf[8];
+        if (!dev->seek(off) ||
+                dev->read(reinterpret_cast<char*>(buf), count_len)
+                != count_len)
+        {
+            break;
+        }
+        const qint64 n = tiff_read(buf, count_len, h.le);
+        if (!dev->seek(off + count_len + n * entry_len) ||
+                dev->read(reinterpret_cast<char*>(buf), next_len)
+                != next_len)
+        {
+            break;
+        }
+        off = tiff_read(buf, next_len, h.le);
+    }
+    return offsets;
+}
+
+bool
+TiffPages::decode(const QString &path, qint64 ifd, QImage &img)
+{
+    QFile file(path);
+    tiff_header h;
+    if (!file.open(QIODevice::ReadOnly) || !read_header(&file, h))
+    {
+        return false;
+    }
+
+    TiffPageDevice dev(&file, h, ifd);
+    dev.open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+    dev.seek(0);
+    QImageReader reader(&dev, "tiff");
+    return reader.read(&img);
+}
+
+bool
+TiffPages::probe(const QString &path, qint64 ifd, QSize &size)
+{
+    QFile file(path);
+    tiff_header h;
+    if (!file.open(QIODevice::ReadOnly) || !read_header(&file, h))
+    {
+        return false;
+    }
+
+    TiffPageDevice dev(&file, h, ifd);
+    dev.open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+    dev.seek(0);
+    QImageReader reader(&dev, "tiff");
+    size = reader.size();
+    return size.isValid();
+}
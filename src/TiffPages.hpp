@@ -0,0 +1,28 @@
+#ifndef TIFFPAGES_HPP
+#define TIFFPAGES_HPP
+
+#include <QString>
+#include <QVector>
+#include <QImage>
+#include <QSize>
+
+class QIODevice;
+
+// 複数ページのTIFFをページごとに扱う．
+// 開くときに各ページのIFDの位置を調べておき，デコードするときは
+// ヘッダの先頭IFDの位置だけをそのページに差し替えて見せる
+class TiffPages
+{
+public:
+    // IFDの位置をページ順に返す
+    static QVector<qint64> index(const QString &path);
+    static QVector<qint64> index(QIODevice *dev);
+
+    static bool decode(const QString &path, qint64 ifd, QImage &img);
+    static bool probe(const QString &path, qint64 ifd, QSize &size);
+
+private:
+    TiffPages() = delete;
+};
+
+#endif // TIFFPAGES_HPP
@@ -6,10 +6,17 @@
 
 #include "for_windows_env.hpp"
 
+static QImage (*const scalers[])(const QImage &, const double) =
+{
+    nn, bl, bc,
+};
+
 Viewer::Viewer(QWidget *parent)
     : QWidget(parent)
     , based_imgs()
     , scaled_imgs()
+    , based_sizes()
+    , page_sizes()
     , img_num(0)
     , scale_mode(Bilinear)
     , scale_factor(1.0)
@@ -24,10 +31,20 @@ Viewer::Viewer(QWidget *parent)
     , click2_pos()
     , move_pos()
     , img_pos()
+    , anim_player()
+    , anim_timer()
+    , anim_slot(0)
+    , anim_scale(1.0)
+    , anim_mode(Bilinear)
+    , anim_frame()
     , drag_detect_time(150)
+    , anim_retry_time(10)
 {
     connect(&drag_timer, SIGNAL(timeout()),
             this, SLOT(drag_check()));
+    anim_timer.setSingleShot(true);
+    connect(&anim_timer, SIGNAL(timeout()),
+            this, SLOT(nextFrame()));
 
     setFocusPolicy(Qt::StrongFocus);
     setAcceptDrops(true);
@@ -98,7 +115,11 @@ Viewer::setRightbindingView(bool rbind)
 {
     bool c = (rbind_view != rbind);
     rbind_view = rbind;
-    if (c) rescaling();
+    if (c)
+    {
+        emit changeRightbinding(rbind);
+        rescaling();
+    }
 }
 
 bool
@@ -140,8 +161,8 @@ Viewer::getImageSize() const
     int h = 0;
     for (int i = 0; i < img_num; ++i)
     {
-        w += based_imgs[i].width();
-        h = std::max(h, based_imgs[i].height());
+        w += based_sizes[i].width();
+        h = std::max(h, based_sizes[i].height());
     }
     return QSize(w, h);
 }
@@ -149,12 +170,77 @@ Viewer::getImageSize() const
 void
 Viewer::showImages(const QImage &imgl, const QImage &imgr)
 {
-    based_imgs[0] = imgl;
-    based_imgs[1] = imgr;
+    stopAnimation();
+    setBasedImages(imgl, imgr);
     img_pos = QPoint(0, 0);
     rescaling();
 }
 
+void
+Viewer::updateImages(const QImage &imgl, const QImage &imgr)
+{
+    // 同じページの画像の更新なので表示位置はそのままにする
+    setBasedImages(imgl, imgr);
+    rescaling();
+}
+
+void
+Viewer::playAnimation(int slot, const QByteArray &data)
+{
+    if (slot < 0 || 2 <= slot || based_imgs[slot].isNull()) return;
+
+    anim_slot = slot;
+    anim_scale = imageScale(slot);
+    anim_mode = scale_mode;
+    anim_frame = QImage();
+    anim_player.play(data, anim_scale, scalers[anim_mode]);
+    anim_timer.start(0);
+}
+
+void
+Viewer::setPageSizes(const QSize &size_l, const QSize &size_r)
+{
+    page_sizes[0] = size_l;
+    page_sizes[1] = size_r;
+}
+
+void
+Viewer::setBasedImages(const QImage &imgl, const QImage &imgr)
+{
+    based_imgs[0] = imgl;
+    based_imgs[1] = imgr;
+    for (int i = 0; i < 2; ++i)
+    {
+        // 仮の画像はdevicePixelRatioで本来の大きさを表している
+        const double r = based_imgs[i].devicePixelRatio();
+        if (r != 1.0 && !page_sizes[i].isEmpty())
+        {
+            // ヘッダから分かっていればそちらで見開きや倍率を決める
+            based_sizes[i] = page_sizes[i];
+        }
+        else
+        {
+            based_sizes[i] = QSize(qRound(based_imgs[i].width() / r),
+                    qRound(based_imgs[i].height() / r));
+        }
+    }
+}
+
+double
+Viewer::imageScale(int i) const
+{
+    if (based_imgs[i].isNull()) return scale_factor;
+    return scale_factor * based_sizes[i].width() / based_imgs[i].width();
+}
+
+void
+Viewer::stopAnimation()
+{
+    anim_timer.stop();
+    anim_player.stop();
+    anim_frame = QImage();
+}
+
 void
 Viewer::paintEvent(QPaintEvent *event)
 {
@@ -368,6 +454,22 @@ Viewer::mouseMoveEvent(QMouseEvent *event)
     event->accept();
 }
 
+void
+Viewer::nextFrame()
+{
+    AnimationPlayer::Frame frame;
+    if (!anim_player.takeFrame(frame))
+    {
+        if (anim_player.isPlaying()) anim_timer.start(anim_retry_time);
+        return;
+    }
+
+    anim_frame = frame.img;
+    scaled_imgs[anim_slot] = anim_frame;
+    update();
+    anim_timer.start(frame.delay);
+}
+
 void
 Viewer::drag_check()
 {
@@ -391,15 +493,15 @@ Viewer::rescaling()
             !based_imgs[1].isNull())
     {
         img_num = 2;
-        cimg_w = based_imgs[0].width() + based_imgs[1].width();
+        cimg_w = based_sizes[0].width() + based_sizes[1].width();
         cimg_h = std::max(
-                based_imgs[0].height(),
-                based_imgs[1].height());
+                based_sizes[0].height(),
+                based_sizes[1].height());
         if (getAutoAdjustSpread())
         {
             double v_wh = width() / static_cast<double>(height());
-            int img1_w = based_imgs[0].width();
-            int img1_h = based_imgs[0].height();
+            int img1_w = based_sizes[0].width();
+            int img1_h = based_sizes[0].height();
             double img1_wh = img1_w / static_cast<double>(img1_h);
             double img2_wh = cimg_w /
                 static_cast<double>(cimg_h);
@@ -414,8 +516,8 @@ Viewer::rescaling()
     else if (!based_imgs[0].isNull())
     {
         img_num = 1;
-        cimg_w = based_imgs[0].width();
-        cimg_h = based_imgs[0].height();
+        cimg_w = based_sizes[0].width();
+        cimg_h = based_sizes[0].height();
     }
     else
     {
@@ -457,17 +559,38 @@ Viewer::rescaling()
     }
     scale_factor = scale;
 
-    if (qFuzzyCompare(scale_factor, 1.0))
+    for (int i = 0; i < img_num; ++i)
     {
-        scaled_imgs[0] = based_imgs[0];
-        scaled_imgs[1] = based_imgs[1];
+        // 仮の画像は本来の大きさより画素数が少ない
+        const double s = imageScale(i);
+        if (qFuzzyCompare(s, 1.0))
+        {
+            scaled_imgs[i] = based_imgs[i];
+            if (scaled_imgs[i].devicePixelRatio() != 1.0)
+            {
+                scaled_imgs[i].setDevicePixelRatio(1.0);
+            }
+        }
+        else
+        {
+            scaled_imgs[i] = scalers[scale_mode](based_imgs[i], s);
+        }
     }
-    else
+
+    if (anim_player.isPlaying())
     {
-        QImage (*f[])(const QImage &, const double) = {nn, bl, bc};
-        for (int i = 0; i < img_num; ++i)
+        const double s = imageScale(anim_slot);
+        if (!qFuzzyCompare(s, anim_scale) || scale_mode != anim_mode)
+        {
+            // 先読みしたフレームは倍率が違うので作り直させる
+            anim_scale = s;
+            anim_mode = scale_mode;
+            anim_frame = QImage();
+            anim_player.setScale(anim_scale, scalers[anim_mode]);
+        }
+        else if (!anim_frame.isNull())
         {
-            scaled_imgs[i] = f[scale_mode](based_imgs[i], scale_factor);
+            scaled_imgs[anim_slot] = anim_frame;
         }
     }
     if (old_imgnum != img_num) emit changeNumOfImages(img_num);
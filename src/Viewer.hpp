@@ -12,6 +12,7 @@
 #include <QDropEvent>
 #include <QMouseEvent>
 #include <QPoint>
+#include "AnimationPlayer.hpp"
 
 class Viewer : public QWidget
 {
@@ -65,10 +66,14 @@ signals:
     void nextImageRequest();
     void prevImageRequest();
     void changeNumOfImages(int n);
+    void changeRightbinding(bool rbind);
     void openImageFiles(const QStringList &paths);
 
 protected slots:
     void showImages(const QImage &img_l, const QImage &img_r);
+    void updateImages(const QImage &img_l, const QImage &img_r);
+    void playAnimation(int slot, const QByteArray &data);
+    void setPageSizes(const QSize &size_l, const QSize &size_r);
 
 protected:
     void paintEvent(QPaintEvent *event);
@@ -82,10 +87,13 @@ protected:
 
 private slots:
     void drag_check();
+    void nextFrame();
 
 private:
     QImage based_imgs[2];   // 表示している画像
     QImage scaled_imgs[2];  // スケール後の画像
+    QSize based_sizes[2];   // 表示している画像の本来の大きさ
+    QSize page_sizes[2];    // ヘッダから分かったページの大きさ
     int img_num;
     ScalingMode scale_mode; // 画素補完方法
     double scale_factor;    // 表示倍率
@@ -100,11 +108,22 @@ private:
     QPoint click2_pos;      // 
     QPoint move_pos;        // 移動中の位置
     QPoint img_pos;         // 画像の表示位置
+    AnimationPlayer anim_player;
+    QTimer anim_timer;      // 次のフレームを表示するタイマー
+    int anim_slot;          // アニメーションしている画像
+    double anim_scale;      // anim_playerに渡した倍率
+    ScalingMode anim_mode;
+    QImage anim_frame;      // 表示中のフレーム
 
     // ドラッグと判定するまでの時間(ms)
     const int drag_detect_time;
+    // フレームの先読みが間に合わないときに待つ時間(ms)
+    const int anim_retry_time;
 
     void rescaling();
+    void setBasedImages(const QImage &img_l, const QImage &img_r);
+    double imageScale(int i) const;
+    void stopAnimation();
 };
 
 #endif // VIEWER_HPP
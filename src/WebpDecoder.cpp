@@ -0,0 +1,107 @@
+#include "WebpDecoder.hpp"
+
+#ifdef USE_LIBWEBP
+#include <webp/decode.h>
+
+// scaledが有効ならその大きさに縮小しながらデコードする
+static bool
+webp_decode(const QByteArray &data, const QSize &scaled, QImage &img)
+{
+    const uint8_t *p = reinterpret_cast<const uint8_t*>(data.constData());
+    const size_t len = data.size();
+
+    WebPDecoderConfig config;
+    if (!WebPInitDecoderConfig(&config)) return false;
+    if (WebPGetFeatures(p, len, &config.input) != VP8_STATUS_OK ||
+            config.input.has_animation)
+    {
+        return false;
+    }
+
+    QSize size(config.input.width, config.input.height);
+    if (scaled.isValid() && scaled != size)
+    {
+        config.options.use_scaling = 1;
+        config.options.scaled_width = scaled.width();
+        config.options.scaled_height = scaled.height();
+        size = scaled;
+    }
+    config.options.use_threads = 1;
+
+    QImage out(size, config.input.has_alpha ? QImage::Format_ARGB32
+                                            : QImage::Format_RGB32);
+    if (out.isNull()) return false;
+
+    // 出力先をQImageのバッファにしてコピーを避ける
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+    config.output.colorspace = MODE_BGRA;
+#else
+    config.output.colorspace = MODE_ARGB;
+#endif
+    config.output.is_external_memory = 1;
+    config.output.u.RGBA.rgba = out.bits();
+    config.output.u.RGBA.stride = out.bytesPerLine();
+    config.output.u.RGBA.size =
+        static_cast<size_t>(out.bytesPerLine()) * out.height();
+
+    bool ret = (WebPDecode(p, len, &config) == VP8_STATUS_OK);
+    WebPFreeDecBuffer(&config.output);
+    if (ret) img = out;
+    return ret;
+}
+#endif
+
+bool
+WebpDecoder::isAvailable()
+{
+#ifdef USE_LIBWEBP
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool
+WebpDecoder::readHeader(const QByteArray &data, QSize &size)
+{
+#ifdef USE_LIBWEBP
+    WebPBitstreamFeatures features;
+    if (WebPGetFeatures(reinterpret_cast<const uint8_t*>(data.constData()),
+                data.size(), &features) != VP8_STATUS_OK)
+    {
+        return false;
+    }
+    size = QSize(features.width, features.height);
+    return true;
+#else
+    Q_UNUSED(data);
+    Q_UNUSED(size);
+    return false;
+#endif
+}
+
+bool
+WebpDecoder::decode(const QByteArray &data, QImage &img)
+{
+#ifdef USE_LIBWEBP
+    return webp_decode(data, QSize(), img);
+#else
+    Q_UNUSED(data);
+    Q_UNUSED(img);
+    return false;
+#endif
+}
+
+bool
+WebpDecoder::decodeScaled(const QByteArray &data, const QSize &size,
+        QImage &img)
+{
+#ifdef USE_LIBWEBP
+    return webp_decode(data, size, img);
+#else
+    Q_UNUSED(data);
+    Q_UNUSED(size);
+    Q_UNUSED(img);
+    return false;
+#endif
+}
@@ -0,0 +1,23 @@
+#ifndef WEBPDECODER_HPP
+#define WEBPDECODER_HPP
+
+#include <QByteArray>
+#include <QImage>
+#include <QSize>
+
+// libwebpでデコードする(アニメーションは非対応)
+class WebpDecoder
+{
+public:
+    static bool isAvailable();
+
+    static bool readHeader(const QByteArray &data, QSize &size);
+    static bool decode(const QByteArray &data, QImage &img);
+    static bool decodeScaled(const QByteArray &data, const QSize &size,
+            QImage &img);
+
+private:
+    WebpDecoder() = delete;
+};
+
+#endif // WEBPDECODER_HPP
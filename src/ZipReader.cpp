@@ -0,0 +1,296 @@
+#include <algorithm>
+#include <zlib.h>
+#include "ZipReader.hpp"
+
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#endif
+
+static quint16
+le16(const uchar *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static quint32
+le32(const uchar *p)
+{
+    return quint32(le16(p)) | (quint32(le16(p + 2)) << 16);
+}
+
+static quint64
+le64(const uchar *p)
+{
+    return quint64(le32(p)) | (quint64(le32(p + 4)) << 32);
+}
+
+ZipReader::ZipReader(const QString &path)
+    : file(path)
+    , file_size(0)
+    , list()
+{
+}
+
+ZipReader::~ZipReader()
+{
+}
+
+QSharedPointer<ZipReader>
+ZipReader::open(const QString &path)
+{
+    QSharedPointer<ZipReader> zip(new ZipReader(path));
+    if (!zip->file.open(QIODevice::ReadOnly) || !zip->parse())
+    {
+        return QSharedPointer<ZipReader>();
+    }
+    return zip;
+}
+
+const QVector<ZipReader::Entry> &
+ZipReader::entries() const
+{
+    return list;
+}
+
+bool
+ZipReader::isSupported(const Entry &e)
+{
+    // 暗号化されたものは扱わない
+    return !(e.flags & 1) && (e.method == 0 || e.method == Z_DEFLATED);
+}
+
+bool
+ZipReader::read(const Entry &e, const ImageFile::BlockReader &reader) const
+{
+    return extract(e, reader, 1024*128);
+}
+
+QByteArray
+ZipReader::readHead(const Entry &e, qint64 len) const
+{
+    // 先頭だけなら読み込む単位も小さくする
+    QByteArray head;
+    extract(e, [&head, len](const char *buf, qint64 n)
+            {
+                head.append(buf, std::min(n, len - head.size()));
+                return head.size() < len;
+            },
+            std::max<qint64>(std::min<qint64>(len, 1024*128), 1024*4));
+    return head;
+}
+
+bool
+ZipReader::extract(const Entry &e, const ImageFile::BlockReader &reader,
+        qint64 chunk) const
+{
+    if (!isSupported(e)) return false;
+    qint64 pos = dataOffset(e);
+    if (pos < 0) return false;
+
+    QByteArray in(std::min(chunk, std::max<qint64>(e.csize, 1)),
+            Qt::Uninitialized);
+    qint64 remain = e.csize;
+    uLong crc = crc32(0, Z_NULL, 0);
+
+    if (e.method == 0)
+    {
+        while (remain > 0)
+        {
+            const qint64 n = std::min<qint64>(remain, in.size());
+            if (!readAt(pos, in.data(), n)) return false;
+            crc = crc32(crc, (const Bytef *)in.constData(), n);
+            if (!reader(in.constData(), n)) return false;
+            pos += n;
+            remain -= n;
+        }
+        return crc == e.crc;
+    }
+
+    z_stream zs;
+    zs.zalloc = Z_NULL;
+    zs.zfree = Z_NULL;
+    zs.opaque = Z_NULL;
+    zs.next_in = Z_NULL;
+    zs.avail_in = 0;
+    if (inflateInit2(&zs, -MAX_WBITS) != Z_OK) return false;
+
+    QByteArray out(chunk * 2, Qt::Uninitialized);
+    int r = Z_OK;
+    while (r != Z_STREAM_END)
+    {
+        if (zs.avail_in == 0 && remain > 0)
+        {
+            const qint64 n = std::min<qint64>(remain, in.size());
+            if (!readAt(pos, in.data(), n)) break;
+            pos += n;
+            remain -= n;
+            zs.next_in = (Bytef *)in.data();
+            zs.avail_in = n;
+        }
+        zs.next_out = (Bytef *)out.data();
+        zs.avail_out = out.size();
+        r = inflate(&zs, Z_NO_FLUSH);
+        if (r != Z_OK && r != Z_STREAM_END) break;
+
+        const qint64 len = out.size() - zs.avail_out;
+        if (len > 0)
+        {
+            crc = crc32(crc, (const Bytef *)out.constData(), len);
+            if (!reader(out.constData(), len))
+            {
+                inflateEnd(&zs);
+                return false;
+            }
+        }
+    }
+    inflateEnd(&zs);
+    return r == Z_STREAM_END && crc == e.crc;
+}
+
+bool
+ZipReader::readAt(qint64 pos, void *buf, qint64 len) const
+{
+#ifdef Q_OS_UNIX
+    char *p = static_cast<char *>(buf);
+    while (len > 0)
+    {
+        const ssize_t n = ::pread(file.handle(), p, len, pos);
+        if (n <= 0) return false;
+        p += n;
+        pos += n;
+        len -= n;
+    }
+    return true;
+#else
+    QMutexLocker locker(&mutex);
+    QFile &f = const_cast<QFile &>(file);
+    return f.seek(pos) &&
+        f.read(static_cast<char *>(buf), len) == len;
+#endif
+}
+
+bool
+ZipReader::parse()
+{
+    // 終端レコードはコメントの分だけ末尾から離れていることがある
+    file_size = file.size();
+    const qint64 size = file_size;
+    const qint64 tail = std::min<qint64>(size, 22 + 0xFFFF);
+    if (tail < 22) return false;
+    QByteArray buf(tail, Qt::Uninitialized);
+    if (!readAt(size - tail, buf.data(), tail)) return false;
+
+    const uchar *b = (const uchar *)buf.constData();
+    qint64 i = tail - 22;
+    while (i >= 0 && le32(b + i) != 0x06054b50) --i;
+    if (i < 0) return false;
+
+    const uchar *eocd = b + i;
+    const qint64 eocd_pos = size - tail + i;
+    quint64 count = le16(eocd + 10);
+    quint64 dir_size = le32(eocd + 12);
+    quint64 dir_pos = le32(eocd + 16);
+
+    if (count == 0xFFFF || dir_size == 0xFFFFFFFF || dir_pos == 0xFFFFFFFF)
+    {
+        // Zip64の終端レコードの位置はその直前のロケータにある
+        uchar loc[20];
+        uchar rec[56];
+        if (eocd_pos < 20 ||
+                !readAt(eocd_pos - 20, loc, sizeof(loc)) ||
+                le32(loc) != 0x07064b50 ||
+                !readAt(le64(loc + 8), rec, sizeof(rec)) ||
+                le32(rec) != 0x06064b50)
+        {
+            return false;
+        }
+        count = le64(rec + 32);
+        dir_size = le64(rec + 40);
+        dir_pos = le64(rec + 48);
+    }
+    if (dir_pos + dir_size > quint64(size) || dir_size > 256*1024*1024)
+    {
+        return false;
+    }
+
+    QByteArray dir(dir_size, Qt::Uninitialized);
+    if (!readAt(dir_pos, dir.data(), dir_size)) return false;
+    if (!parseDirectory(dir, count)) return false;
+
+    // 自己解凍形式などで位置がずれていればlibarchiveに任せる
+    return list.isEmpty() || dataOffset(list[0]) >= 0;
+}
+
+bool
+ZipReader::parseDirectory(const QByteArray &dir, qint64 count)
+{
+    const uchar *p = (const uchar *)dir.constData();
+    const uchar *end = p + dir.size();
+    list.reserve(std::min<qint64>(count, dir.size() / 46));
+
+    for (qint64 n = 0; n < count; ++n)
+    {
+        if (end - p < 46 || le32(p) != 0x02014b50) return false;
+        const int nlen = le16(p + 28);
+        const int xlen = le16(p + 30);
+        const int clen = le16(p + 32);
+        if (end - p < 46 + nlen + xlen + clen) return false;
+
+        Entry e;
+        e.name = QByteArray((const char *)p + 46, nlen);
+        e.flags = le16(p + 8);
+        e.method = le16(p + 10);
+        e.crc = le32(p + 16);
+        e.csize = le32(p + 20);
+        e.usize = le32(p + 24);
+        e.offset = le32(p + 42);
+
+        // 4GiBを超える値はZip64の拡張フィールドに入っている
+        const uchar *x = p + 46 + nlen;
+        const uchar *xend = x + xlen;
+        while (xend - x >= 4)
+        {
+            const int id = le16(x);
+            const int len = le16(x + 2);
+            const uchar *v = x + 4;
+            const uchar *vend = std::min(v + len, xend);
+            if (id == 0x0001)
+            {
+                if (e.usize == 0xFFFFFFFF && vend - v >= 8)
+                {
+                    e.usize = le64(v);
+                    v += 8;
+                }
+                if (e.csize == 0xFFFFFFFF && vend - v >= 8)
+                {
+                    e.csize = le64(v);
+                    v += 8;
+                }
+                if (e.offset == 0xFFFFFFFF && vend - v >= 8)
+                {
+                    e.offset = le64(v);
+                }
+                break;
+            }
+            x += 4 + len;
+        }
+        p += 46 + nlen + xlen + clen;
+
+        if (e.name.endsWith("/")) continue;
+        list << e;
+    }
+    return true;
+}
+
+qint64
+ZipReader::dataOffset(const Entry &e) const
+{
+    uchar h[30];
+    if (!readAt(e.offset, h, sizeof(h)) || le32(h) != 0x04034b50)
+    {
+        return -1;
+    }
+    const qint64 pos = e.offset + 30 + le16(h + 26) + le16(h + 28);
+    if (pos + e.csize > file_size) return -1;
+    return pos;
+}
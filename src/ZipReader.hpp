@@ -0,0 +1,62 @@
+#ifndef ZIPREADER_HPP
+#define ZIPREADER_HPP
+
+#include <QString>
+#include <QByteArray>
+#include <QVector>
+#include <QFile>
+#include <QMutex>
+#include <QSharedPointer>
+#include "ImageFile.hpp"
+
+// 中央ディレクトリを読んでエントリへ直接シークするzipの読み込み．
+// 読み込みはpreadで行うので，複数のスレッドから同時に別のエントリを
+// 取り出せる．無圧縮とDeflate以外のエントリはlibarchiveに任せる
+class ZipReader
+{
+public:
+    struct Entry
+    {
+        QByteArray name;
+        int flags;
+        int method;
+        quint32 crc;
+        qint64 csize;       // 圧縮後の大きさ
+        qint64 usize;       // 展開後の大きさ
+        qint64 offset;      // ローカルヘッダの位置
+    };
+
+    ~ZipReader();
+    ZipReader(const ZipReader &) = delete;
+    ZipReader &operator=(const ZipReader &) = delete;
+
+    // zipでなければnull
+    static QSharedPointer<ZipReader> open(const QString &path);
+
+    const QVector<Entry> &entries() const;
+    static bool isSupported(const Entry &e);
+
+    // 展開したデータを順にreaderへ渡す．CRCが合わなければfalse
+    bool read(const Entry &e, const ImageFile::BlockReader &reader) const;
+    // 展開したデータの先頭lenバイトまでを返す
+    QByteArray readHead(const Entry &e, qint64 len) const;
+
+private:
+    explicit ZipReader(const QString &path);
+
+    QFile file;
+    qint64 file_size;       // 開いたときの大きさ．読み込み中はfileに触れない
+    QVector<Entry> list;
+#ifndef Q_OS_UNIX
+    mutable QMutex mutex;   // preadが無いのでシークと読み込みを排他する
+#endif
+
+    bool readAt(qint64 pos, void *buf, qint64 len) const;
+    bool extract(const Entry &e, const ImageFile::BlockReader &reader,
+            qint64 chunk) const;
+    bool parse();
+    bool parseDirectory(const QByteArray &dir, qint64 count);
+    qint64 dataOffset(const Entry &e) const;
+};
+
+#endif // ZIPREADER_HPP
@@ -14,18 +14,18 @@ nn(const QImage &src, const double s)
     const int y1 = h-1;
 
     QImage nimg(nw, nh, src.format());
-    QRgb *nbits = (QRgb*)nimg.bits();
-    const QRgb *bits = (QRgb*)src.bits();
 
     for (int y = 0; y < nh; ++y)
     {
-        const int y0 = std::min(static_cast<int>(std::floor(y/s+0.5)), y1)*w;
+        // 別の画像の一部を指していることもあるので行はscanLineで得る
+        QRgb *nbits = (QRgb*)nimg.scanLine(y);
+        const QRgb *bits = (const QRgb*)src.constScanLine(
+                std::min(static_cast<int>(std::floor(y/s+0.5)), y1));
         for (int x = 0; x < nw; ++x)
         {
-            *(nbits+x) = *(bits+y0+
+            *(nbits+x) = *(bits+
                     std::min(static_cast<int>(std::floor(x/s+0.5)), x1));
         }
-        nbits += nw;
     }
 
     return nimg;
@@ -42,8 +42,6 @@ bl(const QImage &src, const double s)
     const int h1 = h-1;
 
     QImage nimg(nw, nh, src.format());
-    QRgb *nbits = (QRgb*)nimg.bits();
-    const QRgb *bits = (QRgb*)src.bits();
 
     // [x], (x-[x])を計算しておく
     int *icache = new int[nw];
@@ -71,8 +69,9 @@ bl(const QImage &src, const double s)
 
         const double ty0 = y0-yg; // y-[y]
         const double ty1 = 1-ty0; // [y]+1-y
-        const int yi0 = std::min(yg, h1)*w;
-        const int yi1 = std::min(yg+1, h1)*w;
+        QRgb *nbits = (QRgb*)nimg.scanLine(y);
+        const QRgb *bits0 = (const QRgb*)src.constScanLine(std::min(yg, h1));
+        const QRgb *bits1 = (const QRgb*)src.constScanLine(std::min(yg+1, h1));
 
         for (int x = 0; x < nw; ++x)
         {
@@ -83,10 +82,11 @@ bl(const QImage &src, const double s)
             const double t4 = d*ty0;      //(x-[x])(y-[y])
 
             const int i = icache[x];
-            const QRgb p00 = *(bits+i  +yi0);
-            const QRgb p10 = *(bits+i+1+yi0);
-            const QRgb p01 = *(bits+i  +yi1);
-            const QRgb p11 = *(bits+i+1+yi1);
+            const int i1 = std::min(i+1, w1);
+            const QRgb p00 = *(bits0+i);
+            const QRgb p10 = *(bits0+i1);
+            const QRgb p01 = *(bits1+i);
+            const QRgb p11 = *(bits1+i1);
 
             *(nbits+x) = qRgba(
                     t1*qRed(p00)   + t2*qRed(p01)   + t3*qRed(p10)   + t4*qRed(p11),
@@ -94,7 +94,6 @@ bl(const QImage &src, const double s)
                     t1*qBlue(p00)  + t2*qBlue(p01)  + t3*qBlue(p10)  + t4*qBlue(p11),
                     t1*qAlpha(p00) + t2*qAlpha(p01) + t3*qAlpha(p10) + t4*qAlpha(p11));
         }
-        nbits += nw;
     }
 
     delete[] icache;
@@ -153,8 +152,6 @@ bc(const QImage &src, const double s)
     const int nh = h*s;
 
     QImage nimg(nw, nh, src.format());
-    QRgb *nbits = (QRgb*)nimg.bits();
-    const QRgb *bits = (QRgb*)src.bits();
 
     double d1[4];
     int dr[4][4], dg[4][4], db[4][4], da[4][4];
@@ -171,6 +168,14 @@ bc(const QImage &src, const double s)
         d1[2] = bicubic_h(1-y2);
         d1[3] = bicubic_h(2-y2);
 
+        QRgb *nbits = (QRgb*)nimg.scanLine(y);
+        const QRgb *rows[4];
+        for (int i = 0; i < 4; ++i)
+        {
+            rows[i] = (const QRgb*)src.constScanLine(
+                    std::min(std::max(yg+i-1, 0), h1));
+        }
+
         for (int x = 0; x < nw; ++x)
         {
             const double x0 = x/s;
@@ -186,9 +191,8 @@ bc(const QImage &src, const double s)
             {
                 for (int j = 0; j < 4; ++j)
                 {
-                    const QRgb rgba(*(bits
-                                      +(std::min(std::max(xg+j-1, 0), w1))
-                                      +(std::min(std::max(yg+i-1, 0), h1)*w)));
+                    const QRgb rgba(*(rows[i]
+                                      +(std::min(std::max(xg+j-1, 0), w1))));
                     dr[i][j] = qRed(rgba);
                     dg[i][j] = qGreen(rgba);
                     db[i][j] = qBlue(rgba);
@@ -202,7 +206,6 @@ bc(const QImage &src, const double s)
                         std::min(std::max(bicubic_matmul(d1, db, d3), 0), 0xFF),
                         std::min(std::max(bicubic_matmul(d1, da, d3), 0), 0xFF));
         }
-        nbits += nw;
     }
 
     return nimg;